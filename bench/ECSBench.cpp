@@ -0,0 +1,571 @@
+﻿#include "ECS.h"
+#include "Components.h"
+#include "Enemy.h"
+#include "Player.h"
+#include "Jobs.h"
+#include <vector>
+#include <chrono>
+#include <string>
+#include <random>
+#include <algorithm>
+
+using namespace kvejken;
+
+namespace kvejken
+{
+    class Model;
+}
+
+// prepreci da bi compiler odstranil zanko
+static volatile float g_sink;
+
+struct Result
+{
+    std::string name;
+    int count;
+    double ms;
+    std::vector<std::pair<std::string, double>> extra;
+};
+static std::vector<Result> g_results;
+
+// izpise vrstico in shrani rezultat za JSON
+static void report(const char* name, int count, double ms, std::vector<std::pair<std::string, double>> extra = {})
+{
+    printf("%-48s %8d  %12.6f ms", name, count, ms);
+    for (const auto& [key, value] : extra)
+        printf("  %s %g", key.c_str(), value);
+    printf("\n");
+    g_results.push_back(Result{ name, count, ms, std::move(extra) });
+}
+
+static void write_json(const char* file_path)
+{
+    FILE* file = fopen(file_path, "w");
+    ASSERT(file != nullptr);
+
+    fprintf(file, "{\n  \"threads\": %d,\n  \"results\": [\n", jobs::thread_count());
+    for (size_t i = 0; i < g_results.size(); i++)
+    {
+        const Result& result = g_results[i];
+        fprintf(file, "    { \"name\": \"%s\", \"count\": %d, \"ms\": %.6f", result.name.c_str(), result.count, result.ms);
+        for (const auto& [key, value] : result.extra)
+            fprintf(file, ", \"%s\": %.6f", key.c_str(), value);
+        fprintf(file, " }%s\n", i + 1 < g_results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+}
+
+// vsak test v praznem svetu, da prejsnji ne vplivajo na velikost tabele entitet in poolov
+template<typename F>
+static void in_new_world(F&& f)
+{
+    ecs::World world;
+    ecs::World* prev = ecs::set_world(&world);
+    f();
+    ecs::set_world(prev);
+}
+
+template<typename F>
+static double time_ms(int repeats, F&& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; i++)
+        f();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return duration.count() * 1000.0 / repeats;
+}
+
+static std::vector<Entity> populate(int count)
+{
+    std::vector<Entity> entities;
+    entities.reserve(count);
+
+    Model* model = (Model*)0x1;
+    for (int i = 0; i < count; i++)
+    {
+        Transform transform;
+        transform.position = glm::vec3((float)i, 0.0f, 0.0f);
+        transform.rotation = glm::quat(1, 0, 0, 0);
+        transform.scale = 1.0f;
+
+        Entity e = ecs::create_entity();
+        ecs::add_component(transform, e);
+        ecs::add_component(model, e);
+        // vsaka druga entiteta je enemy, ostale so npr. interactables
+        if (i % 2 == 0)
+            ecs::add_component(Enemy{ 100, 0.0f }, e);
+        entities.push_back(e);
+    }
+    return entities;
+}
+
+static void clear(const std::vector<Entity>& entities)
+{
+    for (Entity e : entities)
+        ecs::destroy_entity(e);
+}
+
+// osnovne operacije: create/destroy, add/remove, iteracija po enem poolu, nakljucen get_component,
+// odlozen destroy prek CommandBuffer
+static void bench_basic(int count)
+{
+    std::vector<Entity> entities(count);
+    double ms = time_ms(1, [&] {
+        for (int i = 0; i < count; i++)
+            entities[i] = ecs::create_entity();
+    });
+    report("create_entity", count, ms);
+
+    Transform transform = {};
+    transform.rotation = glm::quat(1, 0, 0, 0);
+    ms = time_ms(1, [&] {
+        for (Entity e : entities)
+            ecs::add_component(transform, e);
+    });
+    report("add_component<Transform>", count, ms);
+
+    ms = time_ms(1, [&] {
+        for (Entity e : entities)
+            ecs::remove_component<Transform>(e);
+    });
+    report("remove_component<Transform>", count, ms);
+
+    for (int i = 0; i < count; i++)
+    {
+        transform.position.x = (float)i;
+        ecs::add_component(transform, entities[i]);
+    }
+
+    int repeats = std::max(1, 10'000'000 / count);
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (Transform& transform : ecs::get_components<Transform>())
+            sum += transform.position.x;
+        g_sink = sum;
+    });
+    report("get_components<Transform>", count, ms);
+
+    std::vector<Entity> shuffled = entities;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+    ms = time_ms(std::max(1, repeats / 10), [&] {
+        float sum = 0.0f;
+        for (Entity e : shuffled)
+            sum += ecs::get_component<Transform>(e).position.x;
+        g_sink = sum;
+    });
+    report("get_component<Transform> random", count, ms);
+
+    ms = time_ms(1, [&] {
+        for (Entity e : entities)
+            ecs::destroy_entity(e);
+    });
+    report("destroy_entity", count, ms);
+
+    for (int i = 0; i < count; i++)
+    {
+        entities[i] = ecs::create_entity();
+        ecs::add_component(transform, entities[i]);
+    }
+    ms = time_ms(1, [&] {
+        for (Entity e : entities)
+            ecs::commands().destroy_entity(e);
+        ecs::execute_commands();
+    });
+    report("commands().destroy_entity + execute", count, ms);
+}
+
+static void bench_joined_iteration(int count)
+{
+    std::vector<Entity> entities = populate(count);
+
+    int repeats = std::max(1, 10'000'000 / count);
+    double ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [enemy, model, transform] : ecs::get_components<Enemy, Model*, Transform>())
+        {
+            enemy.animation_time += 0.01f;
+            sum += transform.position.x + enemy.animation_time;
+        }
+        g_sink = sum;
+    });
+
+    report("get_components<Enemy, Model*, Transform>", count, ms);
+
+    // isti join samo da je najvecji pool napisan prvi
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [transform, model, enemy] : ecs::get_components<Transform, Model*, Enemy>())
+        {
+            enemy.animation_time += 0.01f;
+            sum += transform.position.x + enemy.animation_time;
+        }
+        g_sink = sum;
+    });
+
+    report("get_components<Transform, Model*, Enemy>", count, ms);
+
+    // polovica entitet pade ze na testu signature, brez dostopa do komponent
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [model, transform] : ecs::get_components<Model*, Transform>().without<Enemy>())
+            sum += transform.position.x;
+        g_sink = sum;
+    });
+
+    report("get_components<Model*, Transform>.without<Enemy>", count, ms);
+
+    clear(entities);
+}
+
+static void bench_group_iteration(int count)
+{
+    std::vector<Entity> entities = populate(count);
+
+    int repeats = std::max(1, 10'000'000 / count);
+    double ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [enemy, model, transform] : ecs::group<Enemy, Model*, Transform>())
+        {
+            enemy.animation_time += 0.01f;
+            sum += transform.position.x + enemy.animation_time;
+        }
+        g_sink = sum;
+    });
+
+    report("group<Enemy, Model*, Transform>", count, ms);
+
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        ecs::group<Enemy, Model*, Transform>().each([&](Enemy& enemy, Model*&, Transform& transform) {
+            enemy.animation_time += 0.01f;
+            sum += transform.position.x + enemy.animation_time;
+        });
+        g_sink = sum;
+    });
+
+    report("group<Enemy, Model*, Transform>.each", count, ms);
+
+    // vsota ni smiselna pri vec threadih, zato samo updata komponente
+    ms = time_ms(repeats, [] {
+        ecs::group<Enemy, Model*, Transform>().parallel_each([](Enemy& enemy, Model*&, Transform& transform) {
+            enemy.animation_time += 0.01f;
+            transform.position.y += enemy.animation_time;
+        });
+    });
+
+    report("group<Enemy, Model*, Transform>.parallel_each", count, ms);
+
+    clear(entities);
+}
+
+// najdaljsi posamezen add_component, pri std::vector so to kopiranja ob vecanju kapacitete
+static void bench_add_spikes(int count)
+{
+    std::vector<Entity> entities;
+    entities.reserve(count);
+
+    double total_ms = 0.0, worst_ms = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        Entity e = ecs::create_entity();
+        Transform transform = {};
+        double ms = time_ms(1, [&] { ecs::add_component(transform, e); });
+        total_ms += ms;
+        worst_ms = std::max(worst_ms, ms);
+        entities.push_back(e);
+    }
+
+    report("add_component<Transform> spikes", count, total_ms, { { "worst_ms", worst_ms } });
+    clear(entities);
+}
+
+// horde spawn: count enemyjev v enem framu, z add_component ali iz prefaba
+static void bench_spawn(int count)
+{
+    Transform transform;
+    transform.position = glm::vec3(0.0f);
+    transform.rotation = glm::quat(1, 0, 0, 0);
+    transform.scale = 0.57f;
+    Model* model = (Model*)0x1;
+
+    std::vector<Entity> entities;
+    double add_ms = 0.0, prefab_ms = 0.0;
+    int repeats = 100;
+    for (int r = 0; r < repeats; r++)
+    {
+        add_ms += time_ms(1, [&] {
+            for (int i = 0; i < count; i++)
+            {
+                Entity e = ecs::create_entity();
+                ecs::add_component(Enemy{ 100, 0.0f }, e);
+                ecs::add_component(transform, e);
+                ecs::add_component(model, e);
+                entities.push_back(e);
+            }
+        });
+        clear(entities);
+        entities.clear();
+    }
+
+    ecs::Prefab eel;
+    eel.set(Enemy{ 100, 0.0f }).set(transform).set(model);
+    for (int r = 0; r < repeats; r++)
+    {
+        prefab_ms += time_ms(1, [&] { entities = ecs::instantiate(eel, count); });
+        clear(entities);
+    }
+
+    report("spawn with add_component", count, add_ms / repeats);
+    report("spawn with ecs::instantiate", count, prefab_ms / repeats);
+}
+
+// iskanje sosedov v mrezi: za vsako entiteto v vrstnem redu poola prebere Transform vseh entitet
+// v sosednjih celicah, pred in po urejanju poola po Morton kodi
+static void bench_spatial_sort(int count)
+{
+    constexpr float CELL_SIZE = 2.0f;
+    constexpr int GRID = 50;
+
+    std::vector<Entity> entities;
+    for (int i = 0; i < count; i++)
+    {
+        Transform transform = {};
+        transform.position = glm::vec3(utils::randf(0.0f, 0.99f), utils::randf(0.0f, 0.99f), utils::randf(0.0f, 0.99f)) * (GRID * CELL_SIZE);
+        Entity e = ecs::create_entity();
+        ecs::add_component(transform, e);
+        entities.push_back(e);
+    }
+
+    auto cell_of = [](glm::vec3 position) {
+        glm::ivec3 cell = glm::ivec3(position / CELL_SIZE);
+        return glm::clamp(cell, glm::ivec3(0), glm::ivec3(GRID - 1));
+    };
+
+    std::vector<std::vector<Entity>> grid(GRID * GRID * GRID);
+    for (auto [id, transform] : ecs::get_components_ids<Transform>())
+    {
+        glm::ivec3 c = cell_of(transform.position);
+        grid[(c.z * GRID + c.y) * GRID + c.x].push_back(id);
+    }
+
+    auto neighbors = [&]() {
+        ComponentPool<Transform>& pool = ecs::get_components<Transform>();
+        int close = 0;
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            glm::vec3 position = pool.component_at(i).position;
+            glm::ivec3 c = cell_of(position);
+            for (int z = std::max(c.z - 1, 0); z <= std::min(c.z + 1, GRID - 1); z++)
+            for (int y = std::max(c.y - 1, 0); y <= std::min(c.y + 1, GRID - 1); y++)
+            for (int x = std::max(c.x - 1, 0); x <= std::min(c.x + 1, GRID - 1); x++)
+            {
+                for (Entity other : grid[(z * GRID + y) * GRID + x])
+                {
+                    glm::vec3 d = pool.get_component(other).position - position;
+                    if (d.x * d.x + d.y * d.y + d.z * d.z < CELL_SIZE * CELL_SIZE)
+                        close++;
+                }
+            }
+        }
+        g_sink = (float)close;
+    };
+
+    double unsorted_ms = time_ms(3, neighbors);
+
+    double sort_ms = time_ms(1, [] {
+        ecs::sort_pool<Transform>([](Entity, const Transform& transform) {
+            return utils::morton_code(transform.position, CELL_SIZE);
+        });
+    });
+
+    double sorted_ms = time_ms(3, neighbors);
+
+    report("neighbor query by grid", count, unsorted_ms, { { "sorted_ms", sorted_ms }, { "sort_ms", sort_ms } });
+    clear(entities);
+}
+
+// cena observerjev: add/mark_changed/destroy brez njih in s praznim observerjem na Transform
+static void bench_observers(int count)
+{
+    auto run = [count]() {
+        return time_ms(10, [count] {
+            std::vector<Entity> entities;
+            entities.reserve(count);
+            for (int i = 0; i < count; i++)
+            {
+                Entity e = ecs::create_entity();
+                ecs::add_component(Transform{}, e);
+                entities.push_back(e);
+            }
+            for (Entity e : entities)
+                ecs::mark_changed<Transform>(e);
+            clear(entities);
+        });
+    };
+
+    double none_ms = run();
+
+    static int s_calls = 0;
+    uint32_t construct = ecs::on_construct<Transform>().connect([](Entity, Transform&) { s_calls++; });
+    uint32_t update = ecs::on_update<Transform>().connect([](Entity, Transform&) { s_calls++; });
+    uint32_t destroy = ecs::on_destroy<Transform>().connect([](Entity, Transform&) { s_calls++; });
+    double observed_ms = run();
+    ecs::on_construct<Transform>().disconnect(construct);
+    ecs::on_update<Transform>().disconnect(update);
+    ecs::on_destroy<Transform>().disconnect(destroy);
+
+    report("add, mark_changed, destroy", count, none_ms, { { "observed_ms", observed_ms }, { "calls", (double)s_calls } });
+}
+
+// poizvedbe vsak frame: lokalni igralec med ostalimi entitetami in interactables brez enemyjev
+static void bench_query(int count)
+{
+    std::vector<Entity> entities = populate(count);
+
+    Entity player = ecs::create_entity();
+    ecs::add_component(Player{}, player);
+    ecs::add_component(LocalPlayer{}, player);
+    ecs::add_component(Transform{}, player);
+
+    // registracija poizvedb ni del meritve
+    ecs::query<Player, Transform>().with<LocalPlayer>();
+    ecs::query<Model*, Transform>().without<Enemy>();
+
+    int repeats = std::max(1, 10'000'000 / count);
+    double ms = time_ms(repeats, [] {
+        auto [player, transform] = *ecs::get_components<Player, Transform>().with<LocalPlayer>().begin();
+        g_sink = transform.position.x;
+    });
+    report("view<Player, Transform> single", count, ms);
+
+    ms = time_ms(repeats, [] {
+        auto [player, transform] = ecs::query<Player, Transform>().with<LocalPlayer>().single();
+        g_sink = transform.position.x;
+    });
+    report("query<Player, Transform> single", count, ms);
+
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [model, transform] : ecs::get_components<Model*, Transform>().without<Enemy>())
+            sum += transform.position.x;
+        g_sink = sum;
+    });
+    report("view<Model*, Transform>.without<Enemy>", count, ms);
+
+    ms = time_ms(repeats, [] {
+        float sum = 0.0f;
+        for (auto [model, transform] : ecs::query<Model*, Transform>().without<Enemy>())
+            sum += transform.position.x;
+        g_sink = sum;
+    });
+    report("query<Model*, Transform>.without<Enemy>", count, ms);
+
+    ecs::destroy_entity(player);
+    clear(entities);
+}
+
+// vsak svet je ena headless simulacija, vsi svetovi hkrati na vseh threadih
+static void bench_worlds(int world_count, int count)
+{
+    auto simulate = [count]() {
+        std::vector<Entity> entities = populate(count);
+        for (int frame = 0; frame < 100; frame++)
+        {
+            for (auto [enemy, transform] : ecs::query<Enemy, Transform>())
+            {
+                enemy.animation_time += 0.01f;
+                transform.position.y += enemy.animation_time;
+            }
+        }
+        clear(entities);
+    };
+
+    std::vector<std::unique_ptr<ecs::World>> worlds;
+    for (int i = 0; i < world_count; i++)
+        worlds.push_back(std::make_unique<ecs::World>());
+
+    double serial_ms = time_ms(1, [&] {
+        for (auto& world : worlds)
+        {
+            ecs::World* prev = ecs::set_world(world.get());
+            simulate();
+            ecs::set_world(prev);
+        }
+    });
+
+    double parallel_ms = time_ms(1, [&] {
+        jobs::WaitGroup wait_group;
+        for (auto& world : worlds)
+        {
+            ecs::World* w = world.get();
+            jobs::submit([w, &simulate]() {
+                ecs::World* prev = ecs::set_world(w);
+                simulate();
+                ecs::set_world(prev);
+            }, wait_group);
+        }
+        jobs::wait(wait_group);
+    });
+
+    report("worlds x 100 frames", world_count, serial_ms, { { "parallel_ms", parallel_ms } });
+}
+
+static void bench_snapshot(int count)
+{
+    std::vector<Entity> entities = populate(count);
+
+    std::vector<uint8_t> blob;
+    int repeats = std::max(1, 1'000'000 / count);
+    double ms = time_ms(repeats, [&] { blob = ecs::snapshot(); });
+    report("ecs::snapshot", count, ms, { { "kb", blob.size() / 1024.0 } });
+
+    ms = time_ms(repeats, [&] { ecs::restore(blob); });
+    report("ecs::restore", count, ms);
+
+    clear(entities);
+}
+
+// kvejken_ecs_bench [results.json]
+int main(int argc, char** argv)
+{
+    const char* json_path = argc > 1 ? argv[1] : "ecs_bench.json";
+    jobs::init();
+
+    for (int count : { 1'000, 10'000, 100'000, 1'000'000 })
+        in_new_world([count] { bench_basic(count); });
+
+    // pred ostalimi, da tabela entitet ni ze zrasla na 1M
+    for (int count : { 10'000, 100'000 })
+        bench_snapshot(count);
+
+    bench_add_spikes(1'000'000);
+
+    in_new_world([] {
+        for (int count : { 10'000, 100'000 })
+            bench_query(count);
+    });
+
+    bench_worlds(16, 10'000);
+
+    for (int count : { 25'000, 250'000 })
+        in_new_world([count] { bench_spatial_sort(count); });
+
+    bench_observers(100'000);
+
+    for (int count : { 1'000, 10'000, 100'000, 1'000'000 })
+        bench_joined_iteration(count);
+
+    // od tu naprej so Enemy, Model* in Transform pooli v grupi
+    ecs::group<Enemy, Model*, Transform>();
+
+    for (int count : { 1'000, 10'000, 100'000, 1'000'000 })
+        bench_group_iteration(count);
+
+    for (int count : { 100, 1'000 })
+        bench_spawn(count);
+
+    jobs::terminate();
+    write_json(json_path);
+    printf("rezultati v %s\n", json_path);
+}
@@ -8,7 +8,32 @@
 #include "Utils.h"
 #include "ECS.h"
 #include "Components.h"
+#include "Transforms.h"
+#include "Jobs.h"
 #include <chrono>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define BVH_SSE
+#endif
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace kvejken::collision
 {
@@ -20,92 +45,393 @@ namespace kvejken::collision
             glm::vec3 center;
         };
 
+        // 32 bytov, dva noda v cache liniji, samo za gradnjo
+        // notranji node: count == 0, otroka sta first in first + 1
+        // list: trikotniki [first, first + count)
         struct BVHNode
         {
             AABB bounds;
-            uint32_t left_child, right_child;
-            bool is_leaf;
+            uint32_t first;
+            uint32_t count;
+
+            bool is_leaf() const { return count > 0; }
         };
+        static_assert(sizeof(BVHNode) == 32);
 
+        // binarno drevo strnjeno v 4 otroke na node, meje otrok so SoA za SSE test vseh stirih hkrati
+        // otrok i: count == 0 notranji node child[i], sicer trikotniki [child[i], child[i] + count[i])
+        // prazni otroci imajo vse meje +inf, zato jih noben ray ali sfera ne zadane
+        struct BVH4Node
+        {
+            float min_x[4], min_y[4], min_z[4];
+            float max_x[4], max_y[4], max_z[4];
+            uint32_t child[4];
+            uint32_t count[4];
+        };
+        static_assert(sizeof(BVH4Node) == 128);
+
+        // globina drevesa je omejena, da traverse shaja s fiksnim stackom
+        constexpr int BVH_MAX_DEPTH = 64;
+        constexpr int BVH4_STACK_SIZE = 3 * BVH_MAX_DEPTH + 1;
+
+        constexpr int BVH_NUM_BINS = 32;
+        // trikotniki s krajso stranico se ne uporabljajo za kolizijo
+        constexpr float MIN_TRIANGLE_EDGE = 0.064f;
+
+        // gradnja pise v vektorje, raycasti berejo prek m_nodes in m_tris,
+        // ki kazeta v vektorja ali v mmapan cache
         std::vector<BVHNode> m_bvh_nodes;
+        std::vector<BVH4Node> m_bvh4_nodes;
         std::vector<Triangle> m_triangles;
+        const BVH4Node* m_nodes = nullptr;
+        const Triangle* m_tris = nullptr;
 
         std::thread m_bvh_building_thread;
         std::atomic_bool m_bvh_building_thread_done = false;
+        std::mutex m_bvh_join_mutex;
         std::chrono::steady_clock::time_point m_bvh_build_start_time;
+
+        // poddrevesa cakajo v svoji vrsti, job sistem dobi samo joby ki vzamejo eno poddrevo iz nje,
+        // tako gradnja med cakanjem izvaja samo poddrevesa in nikoli sistemov, ki bi cakali na gradnjo
+        struct BVHTask
+        {
+            uint32_t node_index;
+            uint32_t first_free;
+            int depth;
+            jobs::WaitGroup* wait_group;
+        };
+        std::deque<BVHTask> m_bvh_tasks;
+        std::mutex m_bvh_tasks_mutex;
+        jobs::WaitGroup m_bvh_helper_jobs;
+
+        class MappedFile
+        {
+        public:
+            ~MappedFile() { close(); }
+
+            bool open(const char* file_path);
+            void close();
+
+            const uint8_t* data() const { return m_data; }
+            size_t size() const { return m_size; }
+
+        private:
+            const uint8_t* m_data = nullptr;
+            size_t m_size = 0;
+#ifdef WIN32
+            HANDLE m_file = INVALID_HANDLE_VALUE;
+            HANDLE m_mapping = nullptr;
+#endif
+        };
+
+        // parametri gradnje so v kljucu, ob spremembi BVHNode, Triangle ali algoritma gradnje povecaj BVH_CACHE_VERSION
+        constexpr const char* BVH_CACHE_PATH = "kvejken_bvh_cache.bin";
+        constexpr const char* BVH_CACHE_TEMP_PATH = "kvejken_bvh_cache.bin.tmp";
+        constexpr uint32_t BVH_CACHE_VERSION = 3;
+
+        struct BVHCacheHeader
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t key;
+            uint32_t node_size, triangle_size;
+            uint32_t node_count, triangle_count;
+            float build_ms;
+        };
+
+        MappedFile m_bvh_cache_file;
+        uint64_t m_bvh_cache_key = 0;
+
+        // trikotniki RectColliderjev po entity_index, da se ne racunajo za vsak raycast
+        std::vector<std::pair<Triangle, Triangle>> m_rect_tris;
+        uint32_t m_rect_tris_tick = 0;
     }
 
-    static void update_node_bounds(BVHNode& node)
+#ifdef WIN32
+    bool MappedFile::open(const char* file_path)
     {
-        ASSERT(node.is_leaf);
-        node.bounds.min = glm::vec3(1e30f);
-        node.bounds.max = glm::vec3(-1e30f);
+        close();
+
+        m_file = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return false;
 
-        for (int i = node.left_child; i <= node.right_child; i++)
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
         {
-            node.bounds.min = glm::min(node.bounds.min, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
-            node.bounds.max = glm::max(node.bounds.max, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
+            close();
+            return false;
+        }
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping != nullptr)
+            m_data = (const uint8_t*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_data == nullptr)
+        {
+            close();
+            return false;
         }
+
+        m_size = (size_t)size.QuadPart;
+        return true;
     }
 
-    float evaluate_sah(BVHNode& node, float split_pos, int axis)
+    void MappedFile::close()
+    {
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+        if (m_mapping != nullptr)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+
+        m_data = nullptr;
+        m_size = 0;
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    bool MappedFile::open(const char* file_path)
     {
-        ASSERT(node.is_leaf);
+        close();
 
-        AABB left_bounds = { glm::vec3(1e30f), glm::vec3(-1e30f) };
-        AABB right_bounds = { glm::vec3(1e30f), glm::vec3(-1e30f) };
-        int left_count = 0;
-        int right_count = 0;
+        int fd = ::open(file_path, O_RDONLY);
+        if (fd == -1)
+            return false;
 
-        for (int i = node.left_child; i <= node.right_child; i++)
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
         {
-            if (m_triangles[i].center[axis] > split_pos)
-            {
-                right_count++;
-                right_bounds.min = glm::min(right_bounds.min, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
-                right_bounds.max = glm::max(right_bounds.max, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
-            }
-            else
+            ::close(fd);
+            return false;
+        }
+
+        // mapping ostane veljaven tudi po zaprtju fd
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return false;
+
+        m_data = (const uint8_t*)data;
+        m_size = st.st_size;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data != nullptr)
+            munmap((void*)m_data, m_size);
+
+        m_data = nullptr;
+        m_size = 0;
+    }
+#endif
+
+    // FNV-1a po 32-bitnih besedah cez parametre gradnje, transformacijo in pozicije vertexov
+    // listi nimajo omejitve velikosti, gradnja se ustavi po SAH ali na BVH_MAX_DEPTH
+    static uint64_t bvh_cache_key(const Model& model, glm::vec3 position, glm::quat rotation, glm::vec3 scale)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const float* values, int count) {
+            for (int i = 0; i < count; i++)
             {
-                left_count++;
-                left_bounds.min = glm::min(left_bounds.min, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
-                left_bounds.max = glm::max(left_bounds.max, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
+                uint32_t word;
+                memcpy(&word, &values[i], sizeof(word));
+                hash = (hash ^ word) * 1099511628211ull;
             }
+        };
+
+        float params[] = {
+            (float)BVH_NUM_BINS, (float)BVH_MAX_DEPTH, MIN_TRIANGLE_EDGE,
+            position.x, position.y, position.z,
+            rotation.x, rotation.y, rotation.z, rotation.w,
+            scale.x, scale.y, scale.z,
+        };
+        add(params, sizeof(params) / sizeof(params[0]));
+        for (const auto& mesh : model.meshes())
+        {
+            for (const auto& vertex : mesh.vertices())
+                add(&vertex.position.x, 3);
+            hash = (hash ^ mesh.vertices().size()) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static bool load_bvh_cache(uint64_t key, float* out_build_ms)
+    {
+        if (!m_bvh_cache_file.open(BVH_CACHE_PATH))
+            return false;
+
+        const uint8_t* data = m_bvh_cache_file.data();
+        size_t size = m_bvh_cache_file.size();
+
+        BVHCacheHeader header;
+        if (size < sizeof(header))
+        {
+            m_bvh_cache_file.close();
+            return false;
         }
+        memcpy(&header, data, sizeof(header));
 
-        glm::vec3 l_ext = left_bounds.max - left_bounds.min;
-        glm::vec3 r_ext = right_bounds.max - right_bounds.min;
-        return left_count * (l_ext.x * l_ext.y + l_ext.y * l_ext.z + l_ext.x * l_ext.z)
-            + right_count * (r_ext.x * r_ext.y + r_ext.y * r_ext.z + r_ext.x * r_ext.z);
+        size_t expected_size = sizeof(header)
+            + (size_t)header.node_count * sizeof(BVH4Node)
+            + (size_t)header.triangle_count * sizeof(Triangle);
+
+        if (memcmp(header.magic, "KBVH", 4) != 0 || header.version != BVH_CACHE_VERSION || header.key != key
+            || header.node_size != sizeof(BVH4Node) || header.triangle_size != sizeof(Triangle)
+            || header.node_count == 0 || size != expected_size)
+        {
+            m_bvh_cache_file.close();
+            return false;
+        }
+
+        m_nodes = (const BVH4Node*)(data + sizeof(header));
+        m_tris = (const Triangle*)(data + sizeof(header) + header.node_count * sizeof(BVH4Node));
+        *out_build_ms = header.build_ms;
+        return true;
+    }
+
+    // pise v zacasno datoteko in jo na koncu preimenuje, da crash med pisanjem ne pusti pol zapisanega cache-a
+    static void save_bvh_cache(uint64_t key, float build_ms)
+    {
+        std::ofstream file(BVH_CACHE_TEMP_PATH, std::ios::binary);
+        if (!file.is_open() || !file.good())
+        {
+            printf("WARNING: could not write %s\n", BVH_CACHE_TEMP_PATH);
+            return;
+        }
+
+        BVHCacheHeader header = {};
+        memcpy(header.magic, "KBVH", 4);
+        header.version = BVH_CACHE_VERSION;
+        header.key = key;
+        header.node_size = sizeof(BVH4Node);
+        header.triangle_size = sizeof(Triangle);
+        header.node_count = m_bvh4_nodes.size();
+        header.triangle_count = m_triangles.size();
+        header.build_ms = build_ms;
+
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)m_bvh4_nodes.data(), m_bvh4_nodes.size() * sizeof(BVH4Node));
+        file.write((const char*)m_triangles.data(), m_triangles.size() * sizeof(Triangle));
+        file.close();
+        if (!file.good())
+        {
+            printf("WARNING: could not write %s\n", BVH_CACHE_TEMP_PATH);
+            std::remove(BVH_CACHE_TEMP_PATH);
+            return;
+        }
+
+#ifdef WIN32
+        bool renamed = MoveFileExA(BVH_CACHE_TEMP_PATH, BVH_CACHE_PATH, MOVEFILE_REPLACE_EXISTING);
+#else
+        bool renamed = std::rename(BVH_CACHE_TEMP_PATH, BVH_CACHE_PATH) == 0;
+#endif
+        if (!renamed)
+        {
+            printf("WARNING: could not write %s\n", BVH_CACHE_PATH);
+            std::remove(BVH_CACHE_TEMP_PATH);
+        }
     }
 
-    void find_best_split(BVHNode& node, float* out_sah, float* out_split_pos, int* out_axis)
+    static void update_node_bounds(BVHNode& node)
     {
-        ASSERT(node.is_leaf);
+        ASSERT(node.is_leaf());
+        node.bounds.min = glm::vec3(1e30f);
+        node.bounds.max = glm::vec3(-1e30f);
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            node.bounds.min = glm::min(node.bounds.min, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
+            node.bounds.max = glm::max(node.bounds.max, m_triangles[i].v1, m_triangles[i].v2, m_triangles[i].v3);
+        }
+    }
+
+    static float half_area(const AABB& aabb)
+    {
+        glm::vec3 ext = aabb.max - aabb.min;
+        return ext.x * ext.y + ext.y * ext.z + ext.x * ext.z;
+    }
+
+    static void grow(AABB& aabb, const Triangle& tri)
+    {
+        aabb.min = glm::min(aabb.min, tri.v1, tri.v2, tri.v3);
+        aabb.max = glm::max(aabb.max, tri.v1, tri.v2, tri.v3);
+    }
+
+    static void grow(AABB& aabb, const AABB& other)
+    {
+        aabb.min = glm::min(aabb.min, other.min);
+        aabb.max = glm::max(aabb.max, other.max);
+    }
+
+    // binned SAH: en prehod cez trikotnike napolni bine, nato se vse meje ocenijo s prefix vsotami
+    // https://jacco.ompf2.com/2022/04/21/how-to-build-a-bvh-part-3-quick-builds/
+    static void find_best_split(const BVHNode& node, float* out_sah, float* out_split_pos, int* out_axis)
+    {
+        ASSERT(node.is_leaf());
+
         float best_sah = 1e30f;
         float best_split_pos = 0;
         int best_axis = 0;
 
-        glm::vec3 size = node.bounds.max - node.bounds.min;
+        // bini po mejah sredisc trikotnikov, ne po mejah noda
+        glm::vec3 centers_min(1e30f);
+        glm::vec3 centers_max(-1e30f);
+        for (uint32_t i = node.first; i < node.first + node.count; i++)
+        {
+            centers_min = glm::min(centers_min, m_triangles[i].center);
+            centers_max = glm::max(centers_max, m_triangles[i].center);
+        }
 
-#ifdef NDEBUG
-        constexpr int NUM_SAH_TESTS = 128;
-#else
-        constexpr int NUM_SAH_TESTS = 6;
-#endif
-        for (int i = 0; i < NUM_SAH_TESTS; i++)
+        for (int axis = 0; axis < 3; axis++)
         {
-            float t = (i + 1) / (float)(NUM_SAH_TESTS + 1);
+            float min = centers_min[axis];
+            float max = centers_max[axis];
+            if (min == max)
+                continue;
+
+            AABB bin_bounds[BVH_NUM_BINS];
+            int bin_counts[BVH_NUM_BINS] = {};
+            for (int b = 0; b < BVH_NUM_BINS; b++)
+                bin_bounds[b] = AABB{ glm::vec3(1e30f), glm::vec3(-1e30f) };
+
+            float scale = BVH_NUM_BINS / (max - min);
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                const Triangle& tri = m_triangles[i];
+                int b = std::min(BVH_NUM_BINS - 1, (int)((tri.center[axis] - min) * scale));
+                bin_counts[b]++;
+                grow(bin_bounds[b], tri);
+            }
+
+            // cena meje za binom b: levo bini [0, b], desno (b, BVH_NUM_BINS)
+            float left_areas[BVH_NUM_BINS - 1];
+            int left_counts[BVH_NUM_BINS - 1];
+            AABB left_bounds = { glm::vec3(1e30f), glm::vec3(-1e30f) };
+            int left_count = 0;
+            for (int b = 0; b < BVH_NUM_BINS - 1; b++)
+            {
+                left_count += bin_counts[b];
+                grow(left_bounds, bin_bounds[b]);
+                left_counts[b] = left_count;
+                left_areas[b] = left_count > 0 ? half_area(left_bounds) : 0.0f;
+            }
 
-            for (int j = 0; j < 3; j++)
+            AABB right_bounds = { glm::vec3(1e30f), glm::vec3(-1e30f) };
+            int right_count = 0;
+            for (int b = BVH_NUM_BINS - 1; b > 0; b--)
             {
-                float split_pos = node.bounds.min[j] + size[j] * t;
-                float sah = evaluate_sah(node, split_pos, j);
+                right_count += bin_counts[b];
+                grow(right_bounds, bin_bounds[b]);
+                float right_area = right_count > 0 ? half_area(right_bounds) : 0.0f;
+
+                float sah = left_counts[b - 1] * left_areas[b - 1] + right_count * right_area;
                 if (sah < best_sah)
                 {
                     best_sah = sah;
-                    best_split_pos = split_pos;
-                    best_axis = j;
+                    best_split_pos = min + b / scale;
+                    best_axis = axis;
                 }
             }
         }
@@ -115,25 +441,48 @@ namespace kvejken::collision
         *out_axis = best_axis;
     }
 
+    // vecja poddrevesa se gradijo kot joby
+    constexpr uint32_t BVH_PARALLEL_MIN_TRIANGLES = 4096;
+
+    static void subdivide_node(uint32_t node_index, uint32_t first_free, int depth);
+
+    static bool run_one_bvh_task()
+    {
+        BVHTask task;
+        {
+            std::scoped_lock<std::mutex> lock(m_bvh_tasks_mutex);
+            if (m_bvh_tasks.empty())
+                return false;
+            task = m_bvh_tasks.front();
+            m_bvh_tasks.pop_front();
+        }
+        subdivide_node(task.node_index, task.first_free, task.depth);
+        task.wait_group->done();
+        return true;
+    }
+
+    // poddrevo z n trikotniki ima najvec 2n - 2 potomcev, zato ima vsak node vnaprej rezerviran
+    // razpon [first_free, first_free + 2n - 2) za potomce in drevo ni odvisno od stevila threadov
     // https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
-    static void subdivide_node(uint32_t node_index)
+    static void subdivide_node(uint32_t node_index, uint32_t first_free, int depth)
     {
         BVHNode& node = m_bvh_nodes[node_index];
-        ASSERT(node.is_leaf);
+        ASSERT(node.is_leaf());
+        if (depth >= BVH_MAX_DEPTH - 1)
+            return;
 
         float sah = 0;
         float split_pos = 0;
         int axis = 0;
         find_best_split(node, &sah, &split_pos, &axis);
 
-        glm::vec3 exts = node.bounds.max - node.bounds.min;
-        float parent_sah = (node.right_child - node.left_child + 1) * (exts.x * exts.y + exts.y * exts.z + exts.x * exts.z);
+        float parent_sah = node.count * half_area(node.bounds);
         if (sah > parent_sah)
             return;
 
         // partition
-        int i = node.left_child;
-        int j = node.right_child;
+        int i = node.first;
+        int j = node.first + node.count - 1;
         while (i <= j)
         {
             if (m_triangles[i].center[axis] > split_pos)
@@ -147,43 +496,168 @@ namespace kvejken::collision
             }
         }
 
-        if (i == node.left_child || j == node.right_child)
+        uint32_t count = node.count;
+        uint32_t left_count = i - node.first;
+        if (left_count == 0 || left_count == count)
             return;
 
-        BVHNode left, right;
-        left.left_child = node.left_child;
-        left.right_child = i - 1;
-        left.is_leaf = true;
+        uint32_t left_index = first_free;
+        uint32_t right_index = first_free + 1;
 
-        right.left_child = i;
-        right.right_child = node.right_child;
-        right.is_leaf = true;
+        BVHNode& left = m_bvh_nodes[left_index];
+        left.first = node.first;
+        left.count = left_count;
 
-        node.is_leaf = false;
-        uint32_t left_index = m_bvh_nodes.size();
-        uint32_t right_index = m_bvh_nodes.size() + 1;
-        node.left_child = left_index;
-        node.right_child = right_index;
-        m_bvh_nodes.push_back(left); // pazi invalidejta node reference
-        m_bvh_nodes.push_back(right);
+        BVHNode& right = m_bvh_nodes[right_index];
+        right.first = i;
+        right.count = count - left_count;
 
-        update_node_bounds(m_bvh_nodes[left_index]);
-        update_node_bounds(m_bvh_nodes[right_index]);
+        node.first = left_index;
+        node.count = 0;
 
-        subdivide_node(left_index);
-        subdivide_node(right_index);
+        update_node_bounds(left);
+        update_node_bounds(right);
+
+        uint32_t left_first_free = first_free + 2;
+        uint32_t right_first_free = first_free + 2 * left_count;
+
+        if (count >= BVH_PARALLEL_MIN_TRIANGLES)
+        {
+            jobs::WaitGroup wait_group;
+            wait_group.add(1);
+            {
+                std::scoped_lock<std::mutex> lock(m_bvh_tasks_mutex);
+                m_bvh_tasks.push_back(BVHTask{ left_index, left_first_free, depth + 1, &wait_group });
+            }
+            jobs::submit([]() { run_one_bvh_task(); }, m_bvh_helper_jobs);
+
+            subdivide_node(right_index, right_first_free, depth + 1);
+
+            // jobs::wait bi lahko vzel sistem, ki klice raycast in caka na to gradnjo
+            while (!wait_group.finished())
+            {
+                if (!run_one_bvh_task())
+                    std::this_thread::yield();
+            }
+        }
+        else
+        {
+            subdivide_node(left_index, left_first_free, depth + 1);
+            subdivide_node(right_index, right_first_free, depth + 1);
+        }
+    }
+
+    // vsak BVH4 node prevzame do 4 potomce binarnega noda, vedno razpre notranjega otroka z najvecjo povrsino
+    // otroci ostanejo v vrstnem redu od leve proti desni, zato je vrstni red listov enak kot v binarnem drevesu
+    static uint32_t collapse_bvh4_node(uint32_t binary_index)
+    {
+        uint32_t children[4];
+        int child_count = 0;
+
+        const BVHNode& binary_node = m_bvh_nodes[binary_index];
+        if (binary_node.is_leaf())
+        {
+            children[child_count++] = binary_index;
+        }
+        else
+        {
+            children[child_count++] = binary_node.first;
+            children[child_count++] = binary_node.first + 1;
+        }
+
+        while (child_count < 4)
+        {
+            int best = -1;
+            float best_area = -1.0f;
+            for (int i = 0; i < child_count; i++)
+            {
+                const BVHNode& child = m_bvh_nodes[children[i]];
+                if (!child.is_leaf() && half_area(child.bounds) > best_area)
+                {
+                    best = i;
+                    best_area = half_area(child.bounds);
+                }
+            }
+            if (best == -1)
+                break;
+
+            uint32_t first = m_bvh_nodes[children[best]].first;
+            for (int i = child_count; i > best + 1; i--)
+                children[i] = children[i - 1];
+            children[best] = first;
+            children[best + 1] = first + 1;
+            child_count++;
+        }
+
+        // pazi, rekurzija invalidira reference v m_bvh4_nodes
+        uint32_t index = m_bvh4_nodes.size();
+        m_bvh4_nodes.emplace_back();
+
+        for (int i = 0; i < 4; i++)
+        {
+            AABB bounds = { glm::vec3(INFINITY), glm::vec3(INFINITY) };
+            uint32_t child_index = 0;
+            uint32_t count = 0;
+
+            if (i < child_count)
+            {
+                const BVHNode& child = m_bvh_nodes[children[i]];
+                bounds = child.bounds;
+                if (child.is_leaf())
+                {
+                    child_index = child.first;
+                    count = child.count;
+                }
+                else
+                {
+                    child_index = collapse_bvh4_node(children[i]);
+                }
+            }
+
+            BVH4Node& node = m_bvh4_nodes[index];
+            node.min_x[i] = bounds.min.x;
+            node.min_y[i] = bounds.min.y;
+            node.min_z[i] = bounds.min.z;
+            node.max_x[i] = bounds.max.x;
+            node.max_y[i] = bounds.max.y;
+            node.max_z[i] = bounds.max.z;
+            node.child[i] = child_index;
+            node.count[i] = count;
+        }
+
+        return index;
+    }
+
+    // BVH4 nodi so v depth-first vrstnem redu, binarno drevo po tem ni vec potrebno
+    static void collapse_to_bvh4()
+    {
+        m_bvh4_nodes.clear();
+        m_bvh4_nodes.reserve(m_bvh_nodes.size() / 3 + 1);
+        collapse_bvh4_node(0);
+        m_bvh4_nodes.shrink_to_fit();
+
+        m_bvh_nodes.clear();
+        m_bvh_nodes.shrink_to_fit();
     }
 
     static void build_triangle_bvh_thread()
     {
-        BVHNode root;
-        root.left_child = 0;
-        root.right_child = m_triangles.size() - 1;
-        root.is_leaf = true;
-        m_bvh_nodes.push_back(root);
-        update_node_bounds(m_bvh_nodes[0]);
+        ASSERT(!m_triangles.empty());
+        m_bvh_nodes.resize(2 * m_triangles.size() - 1);
+
+        BVHNode& root = m_bvh_nodes[0];
+        root.first = 0;
+        root.count = m_triangles.size();
+        update_node_bounds(root);
+
+        subdivide_node(0, 1, 0);
+        collapse_to_bvh4();
+
+        m_nodes = m_bvh4_nodes.data();
+        m_tris = m_triangles.data();
 
-        subdivide_node(0);
+        std::chrono::duration<float, std::milli> build_ms = std::chrono::steady_clock::now() - m_bvh_build_start_time;
+        save_bvh_cache(m_bvh_cache_key, build_ms.count());
 
         m_bvh_building_thread_done = true;
     }
@@ -191,10 +665,27 @@ namespace kvejken::collision
     void build_triangle_bvh(const Model& model, glm::vec3 position, glm::quat rotation, glm::vec3 scale)
     {
         ASSERT(m_bvh_building_thread.joinable() == false);
+        auto start_time = std::chrono::steady_clock::now();
 
+        m_nodes = nullptr;
+        m_tris = nullptr;
+        m_bvh_cache_file.close();
         m_bvh_nodes.clear();
+        m_bvh4_nodes.clear();
         m_triangles.clear();
 
+        // terrain.obj se vseeno parsa za renderer, cache preskoci filtriranje trikotnikov in gradnjo
+        m_bvh_cache_key = bvh_cache_key(model, position, rotation, scale);
+        float cached_build_ms = 0.0f;
+        if (load_bvh_cache(m_bvh_cache_key, &cached_build_ms))
+        {
+            std::chrono::duration<float, std::milli> load_ms = std::chrono::steady_clock::now() - start_time;
+            printf("triangle bvh cache hit  %.2f ms (saved %.2f ms)\n", load_ms.count(), cached_build_ms - load_ms.count());
+            m_bvh_building_thread_done = true;
+            return;
+        }
+        printf("triangle bvh cache miss\n");
+
         size_t total_vertices = 0;
         for (const auto& mesh : model.meshes()) {
             total_vertices += mesh.vertices().size();
@@ -215,9 +706,9 @@ namespace kvejken::collision
                 glm::vec3 v2 = transform * glm::vec4(mesh.vertices()[i + 1].position, 1.0f);
                 glm::vec3 v3 = transform * glm::vec4(mesh.vertices()[i + 2].position, 1.0f);
 
-                if (glm::distance2(v1, v2) < 0.064f * 0.064f ||
-                    glm::distance2(v2, v3) < 0.064f * 0.064f ||
-                    glm::distance2(v1, v3) < 0.064f * 0.064f)
+                if (glm::distance2(v1, v2) < MIN_TRIANGLE_EDGE * MIN_TRIANGLE_EDGE ||
+                    glm::distance2(v2, v3) < MIN_TRIANGLE_EDGE * MIN_TRIANGLE_EDGE ||
+                    glm::distance2(v1, v3) < MIN_TRIANGLE_EDGE * MIN_TRIANGLE_EDGE)
                 {
                     skipped++;
                     continue;
@@ -231,10 +722,10 @@ namespace kvejken::collision
         }
 
         printf("triangles ignored for collision: %d\n", skipped);
-        
+
         m_bvh_building_thread_done = false;
+        m_bvh_build_start_time = start_time;
         m_bvh_building_thread = std::thread(build_triangle_bvh_thread);
-        m_bvh_build_start_time = std::chrono::steady_clock::now();
     }
 
     static void print_bvh_build_thread_time()
@@ -244,15 +735,30 @@ namespace kvejken::collision
         printf("triangle bvh built  %.2f ms\n", duration.count() * 1000.0f);
     }
 
-    void check_bvh_build_thread()
+    // raycast se lahko klice iz vec threadov hkrati
+    static void join_bvh_build_thread()
     {
-        if (m_bvh_building_thread_done && m_bvh_building_thread.joinable())
+        // namesto cakanja pomagaj graditi poddrevesa, drugih jobov ne izvaja
+        while (!m_bvh_building_thread_done)
+        {
+            if (!run_one_bvh_task())
+                std::this_thread::yield();
+        }
+
+        std::scoped_lock<std::mutex> lock(m_bvh_join_mutex);
+        if (m_bvh_building_thread.joinable())
         {
             m_bvh_building_thread.join();
             print_bvh_build_thread_time();
         }
     }
 
+    void check_bvh_build_thread()
+    {
+        if (m_bvh_building_thread_done)
+            join_bvh_build_thread();
+    }
+
     // https://jacco.ompf2.com/2022/04/13/how-to-build-a-bvh-part-1-basics/
     std::optional<float> ray_aabb_intersection(const AABB& aabb, glm::vec3 position, glm::vec3 direction, float max_dist)
     {
@@ -273,11 +779,87 @@ namespace kvejken::collision
         return glm::distance2(closest_in_aabb, center) < radius * radius;
     }
 
-    static std::pair<Triangle, Triangle> rect_to_tris(const RectCollider& rect, const Transform& transform)
+    // ray_aabb_intersection za vse 4 otroke, vrne masko zadetih
+    // operandi min/max so v enakem vrstnem redu kot std::min/std::max v skalarni verziji, da se NaN obnasa enako
+    static int ray_aabb4_intersection(const BVH4Node& node, const glm::vec3& position, const glm::vec3& direction, float max_dist, float* out_dist)
+    {
+#ifdef BVH_SSE
+        __m128 px = _mm_set1_ps(position.x), py = _mm_set1_ps(position.y), pz = _mm_set1_ps(position.z);
+        __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+
+        __m128 tx1 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.min_x), px), dx);
+        __m128 tx2 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.max_x), px), dx);
+        __m128 tmin = _mm_min_ps(tx2, tx1);
+        __m128 tmax = _mm_max_ps(tx2, tx1);
+
+        __m128 ty1 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.min_y), py), dy);
+        __m128 ty2 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.max_y), py), dy);
+        tmin = _mm_max_ps(_mm_min_ps(ty2, ty1), tmin);
+        tmax = _mm_min_ps(_mm_max_ps(ty2, ty1), tmax);
+
+        __m128 tz1 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.min_z), pz), dz);
+        __m128 tz2 = _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(node.max_z), pz), dz);
+        tmin = _mm_max_ps(_mm_min_ps(tz2, tz1), tmin);
+        tmax = _mm_min_ps(_mm_max_ps(tz2, tz1), tmax);
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmple_ps(tmin, _mm_set1_ps(max_dist)));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+
+        _mm_storeu_ps(out_dist, tmin);
+        return _mm_movemask_ps(hit);
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            AABB aabb = {
+                glm::vec3(node.min_x[i], node.min_y[i], node.min_z[i]),
+                glm::vec3(node.max_x[i], node.max_y[i], node.max_z[i]),
+            };
+            if (std::optional<float> dist = ray_aabb_intersection(aabb, position, direction, max_dist))
+            {
+                out_dist[i] = *dist;
+                mask |= 1 << i;
+            }
+        }
+        return mask;
+#endif
+    }
+
+    // sphere_aabb_intersection za vse 4 otroke, vrne masko zadetih
+    static int sphere_aabb4_intersection(const BVH4Node& node, const glm::vec3& center, float radius)
     {
-        glm::vec3 right = transform.rotation * glm::vec3(1, 0, 0);
-        glm::vec3 up = transform.rotation * glm::vec3(0, 1, 0);
-        glm::vec3 center = transform.position + transform.rotation * rect.center_offset;
+#ifdef BVH_SSE
+        __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+
+        // glm::clamp(x, min, max) = min(max(x, min), max)
+        __m128 dx = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(node.max_x), _mm_max_ps(_mm_loadu_ps(node.min_x), cx)), cx);
+        __m128 dy = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(node.max_y), _mm_max_ps(_mm_loadu_ps(node.min_y), cy)), cy);
+        __m128 dz = _mm_sub_ps(_mm_min_ps(_mm_loadu_ps(node.max_z), _mm_max_ps(_mm_loadu_ps(node.min_z), cz)), cz);
+
+        __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+        return _mm_movemask_ps(_mm_cmplt_ps(dist2, _mm_set1_ps(radius * radius)));
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            AABB aabb = {
+                glm::vec3(node.min_x[i], node.min_y[i], node.min_z[i]),
+                glm::vec3(node.max_x[i], node.max_y[i], node.max_z[i]),
+            };
+            if (sphere_aabb_intersection(aabb, center, radius))
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // rect colliderji ignorirajo scale, iz world matrike se vzameta samo pozicija in rotacija
+    static std::pair<Triangle, Triangle> rect_to_tris(const RectCollider& rect, const glm::mat4& world)
+    {
+        glm::vec3 right = glm::normalize(glm::vec3(world[0]));
+        glm::vec3 up = glm::normalize(glm::vec3(world[1]));
+        glm::vec3 forward = glm::normalize(glm::vec3(world[2]));
+        glm::vec3 center = glm::vec3(world[3]) + right * rect.center_offset.x + up * rect.center_offset.y + forward * rect.center_offset.z;
 
         float hw = rect.width / 2.0f;
         float hh = rect.height / 2.0f;
@@ -293,19 +875,56 @@ namespace kvejken::collision
         };
     }
 
+    void update_collider_cache()
+    {
+        uint32_t since = m_rect_tris_tick;
+        m_rect_tris_tick = ecs::tick();
+
+        // world matrika se spremeni tudi s starsem, zato se preverijo vsi rect colliderji
+        for (auto [id, rect, transform] : ecs::get_components_ids<RectCollider, Transform>())
+        {
+            if (!world_matrix_changed_since(id, since) && !ecs::get_components<RectCollider>().changed_since(id, since))
+                continue;
+
+            uint32_t index = ecs::entity_index(id);
+            if (index >= m_rect_tris.size())
+                m_rect_tris.resize(index + 1);
+            m_rect_tris[index] = rect_to_tris(rect, world_matrix(id));
+        }
+    }
+
+    static const std::pair<Triangle, Triangle>& cached_rect_tris(Entity entity)
+    {
+        uint32_t index = ecs::entity_index(entity);
+        ASSERT(index < m_rect_tris.size()); // update_collider_cache ni bil poklican
+        return m_rect_tris[index];
+    }
+
     static float raycast_bvh(uint32_t node_index, const glm::vec3& position, const glm::vec3& direction, float max_dist)
     {
-        BVHNode* node = &m_bvh_nodes[node_index];
-        static std::vector<BVHNode*> stack;
-        stack.clear();
+        struct StackEntry
+        {
+            uint32_t child;
+            uint32_t count;
+            float dist;
+        };
+        StackEntry stack[BVH4_STACK_SIZE];
+        int stack_size = 0;
+        stack[stack_size++] = StackEntry{ node_index, 0, 0.0f };
 
-        while (node != nullptr)
+        while (stack_size > 0)
         {
-            if (node->is_leaf)
+            StackEntry entry = stack[--stack_size];
+
+            // medtem je bil najden blizji zadetek
+            if (entry.dist > max_dist)
+                continue;
+
+            if (entry.count > 0)
             {
-                for (int i = node->left_child; i <= node->right_child; i++)
+                for (uint32_t i = entry.child; i < entry.child + entry.count; i++)
                 {
-                    Triangle& tri = m_triangles[i];
+                    const Triangle& tri = m_tris[i];
 
                     glm::vec2 bary_coords;
                     float distance;
@@ -315,56 +934,35 @@ namespace kvejken::collision
                             max_dist = distance;
                     }
                 }
-
-                if (stack.size() > 0)
-                {
-                    node = stack.back();
-                    stack.pop_back();
-                }
-                else
-                {
-                    node = nullptr;
-                }
+                continue;
             }
-            else
-            {
-                BVHNode* left = &m_bvh_nodes[node->left_child];
-                BVHNode* right = &m_bvh_nodes[node->right_child];
 
-                std::optional<float> left_dist = ray_aabb_intersection(left->bounds, position, direction, max_dist);
-                std::optional<float> right_dist = ray_aabb_intersection(right->bounds, position, direction, max_dist);
+            const BVH4Node& node = m_nodes[entry.child];
+            float dists[4];
+            int mask = ray_aabb4_intersection(node, position, direction, max_dist, dists);
 
-                if (left_dist && right_dist)
+            // zadeti otroci od najdaljsega do najblizjega, da je najblizji na vrhu stacka
+            int order[4];
+            int hit_count = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                if (mask & (1 << i))
                 {
-                    if (*left_dist < *right_dist)
+                    int j = hit_count++;
+                    while (j > 0 && dists[order[j - 1]] < dists[i])
                     {
-                        node = left;
-                        stack.push_back(right);
+                        order[j] = order[j - 1];
+                        j--;
                     }
-                    else
-                    {
-                        node = right;
-                        stack.push_back(left);
-                    }
-                }
-                else if (left_dist)
-                {
-                    node = left;
-                }
-                else if (right_dist)
-                {
-                    node = right;
-                }
-                else if (stack.size() > 0)
-                {
-                    node = stack.back();
-                    stack.pop_back();
-                }
-                else
-                {
-                    node = nullptr;
+                    order[j] = i;
                 }
             }
+
+            for (int k = 0; k < hit_count; k++)
+            {
+                int i = order[k];
+                stack[stack_size++] = StackEntry{ node.child[i], node.count[i], dists[i] };
+            }
         }
 
         return max_dist;
@@ -372,19 +970,15 @@ namespace kvejken::collision
 
     std::optional<RaycastHit> raycast(glm::vec3 position, glm::vec3 direction, float max_dist, bool check_other_colliders)
     {
-        if (m_bvh_building_thread.joinable())
-        {
-            m_bvh_building_thread.join();
-            print_bvh_build_thread_time();
-        }
+        join_bvh_build_thread();
 
         float closest_dist = raycast_bvh(0, position, direction, max_dist);
 
         if (check_other_colliders)
         {
-            for (const auto [rect, transform] : ecs::get_components<RectCollider, Transform>())
+            for (const auto [id, rect, transform] : ecs::get_components_ids<RectCollider, Transform>())
             {
-                auto [t1, t2] = rect_to_tris(rect, transform);
+                const auto& [t1, t2] = cached_rect_tris(id);
                 glm::vec2 bary_coords;
                 float distance;
                 if (glm::intersectRayTriangle(position, direction, t1.v1, t1.v2, t1.v3, bary_coords, distance))
@@ -410,6 +1004,168 @@ namespace kvejken::collision
         return std::nullopt;
     }
 
+    void raycast_batch(glm::vec3 position, const glm::vec3* directions, int count, float max_dist,
+        std::optional<RaycastHit>* out_hits, bool check_other_colliders)
+    {
+        ASSERT(count <= RAYCAST_BATCH_MAX);
+        join_bvh_build_thread();
+
+        float closest_dist[RAYCAST_BATCH_MAX];
+        for (int r = 0; r < count; r++)
+            closest_dist[r] = max_dist;
+
+        // bit r je ray r, ki lahko zadane trikotnik v tem poddrevesu
+        struct StackEntry
+        {
+            uint32_t child;
+            uint32_t count;
+            uint32_t rays;
+        };
+        StackEntry stack[BVH4_STACK_SIZE];
+        int stack_size = 0;
+        stack[stack_size++] = StackEntry{ 0, 0, count == 32 ? ~0u : (1u << count) - 1 };
+
+#ifdef BVH_SSE
+        __m128 px = _mm_set1_ps(position.x), py = _mm_set1_ps(position.y), pz = _mm_set1_ps(position.z);
+#endif
+
+        while (stack_size > 0)
+        {
+            StackEntry entry = stack[--stack_size];
+
+            if (entry.count > 0)
+            {
+                for (uint32_t i = entry.child; i < entry.child + entry.count; i++)
+                {
+                    const Triangle& tri = m_tris[i];
+
+                    // glm::intersectRayTriangle razdeljen na del, ki je za skupno izhodisce enak za vse raye, in del za vsak ray
+                    glm::vec3 edge1 = tri.v2 - tri.v1;
+                    glm::vec3 edge2 = tri.v3 - tri.v1;
+                    glm::vec3 to_origin = position - tri.v1;
+                    glm::vec3 perpendicular = glm::cross(to_origin, edge1);
+                    float distance_numerator = glm::dot(edge2, perpendicular);
+
+                    for (uint32_t rays = entry.rays; rays != 0; rays &= rays - 1)
+                    {
+                        int r = ecs::lowest_set_bit(rays);
+                        const glm::vec3& direction = directions[r];
+
+                        glm::vec3 p = glm::cross(direction, edge2);
+                        float det = glm::dot(edge1, p);
+                        float u = glm::dot(to_origin, p);
+                        float v = glm::dot(direction, perpendicular);
+
+                        if (det > std::numeric_limits<float>::epsilon())
+                        {
+                            if (u < 0.0f || u > det || v < 0.0f || u + v > det)
+                                continue;
+                        }
+                        else if (det < -std::numeric_limits<float>::epsilon())
+                        {
+                            if (u > 0.0f || u < det || v > 0.0f || u + v < det)
+                                continue;
+                        }
+                        else
+                        {
+                            continue;
+                        }
+
+                        float distance = distance_numerator * (1.0f / det);
+                        if (distance > 0.0f && distance < closest_dist[r])
+                            closest_dist[r] = distance;
+                    }
+                }
+                continue;
+            }
+
+            const BVH4Node& node = m_nodes[entry.child];
+#ifdef BVH_SSE
+            // razlike do izhodisca so enake za vse raye, ostalo kot v ray_aabb4_intersection
+            __m128 min_x = _mm_sub_ps(_mm_loadu_ps(node.min_x), px), max_x = _mm_sub_ps(_mm_loadu_ps(node.max_x), px);
+            __m128 min_y = _mm_sub_ps(_mm_loadu_ps(node.min_y), py), max_y = _mm_sub_ps(_mm_loadu_ps(node.max_y), py);
+            __m128 min_z = _mm_sub_ps(_mm_loadu_ps(node.min_z), pz), max_z = _mm_sub_ps(_mm_loadu_ps(node.max_z), pz);
+#endif
+            uint32_t child_rays[4] = {};
+            for (uint32_t rays = entry.rays; rays != 0; rays &= rays - 1)
+            {
+                int r = ecs::lowest_set_bit(rays);
+#ifdef BVH_SSE
+                __m128 dx = _mm_set1_ps(directions[r].x), dy = _mm_set1_ps(directions[r].y), dz = _mm_set1_ps(directions[r].z);
+
+                __m128 tx1 = _mm_div_ps(min_x, dx);
+                __m128 tx2 = _mm_div_ps(max_x, dx);
+                __m128 tmin = _mm_min_ps(tx2, tx1);
+                __m128 tmax = _mm_max_ps(tx2, tx1);
+
+                __m128 ty1 = _mm_div_ps(min_y, dy);
+                __m128 ty2 = _mm_div_ps(max_y, dy);
+                tmin = _mm_max_ps(_mm_min_ps(ty2, ty1), tmin);
+                tmax = _mm_min_ps(_mm_max_ps(ty2, ty1), tmax);
+
+                __m128 tz1 = _mm_div_ps(min_z, dz);
+                __m128 tz2 = _mm_div_ps(max_z, dz);
+                tmin = _mm_max_ps(_mm_min_ps(tz2, tz1), tmin);
+                tmax = _mm_min_ps(_mm_max_ps(tz2, tz1), tmax);
+
+                __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmple_ps(tmin, _mm_set1_ps(closest_dist[r])));
+                hit = _mm_and_ps(hit, _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+                int mask = _mm_movemask_ps(hit);
+#else
+                float dists[4];
+                int mask = ray_aabb4_intersection(node, position, directions[r], closest_dist[r], dists);
+#endif
+                for (int i = 0; i < 4; i++)
+                {
+                    if (mask & (1 << i))
+                        child_rays[i] |= 1u << r;
+                }
+            }
+
+            for (int i = 3; i >= 0; i--)
+            {
+                if (child_rays[i] != 0)
+                    stack[stack_size++] = StackEntry{ node.child[i], node.count[i], child_rays[i] };
+            }
+        }
+
+        for (int r = 0; r < count; r++)
+        {
+            const glm::vec3& direction = directions[r];
+            if (check_other_colliders)
+            {
+                for (const auto [id, rect, transform] : ecs::get_components_ids<RectCollider, Transform>())
+                {
+                    const auto& [t1, t2] = cached_rect_tris(id);
+                    glm::vec2 bary_coords;
+                    float distance;
+                    if (glm::intersectRayTriangle(position, direction, t1.v1, t1.v2, t1.v3, bary_coords, distance))
+                    {
+                        if (distance > 0.0f && distance < closest_dist[r])
+                            closest_dist[r] = distance;
+                    }
+                    if (glm::intersectRayTriangle(position, direction, t2.v1, t2.v2, t2.v3, bary_coords, distance))
+                    {
+                        if (distance > 0.0f && distance < closest_dist[r])
+                            closest_dist[r] = distance;
+                    }
+                }
+            }
+
+            if (closest_dist[r] < max_dist)
+            {
+                RaycastHit hit;
+                hit.position = position + direction * closest_dist[r];
+                hit.distance = closest_dist[r];
+                out_hits[r] = hit;
+            }
+            else
+            {
+                out_hits[r] = std::nullopt;
+            }
+        }
+    }
+
     glm::vec3 closest_point_on_line(glm::vec3 a, glm::vec3 b, glm::vec3 p)
     {
         glm::vec3 n = b - a;
@@ -496,11 +1252,7 @@ namespace kvejken::collision
 
     std::optional<ResolvedCollision> sphere_collision(glm::vec3 center, float radius, glm::vec3 velocity, float max_ground_angle, float slide_threshold)
     {
-        if (m_bvh_building_thread.joinable())
-        {
-            m_bvh_building_thread.join();
-            print_bvh_build_thread_time();
-        }
+        join_bvh_build_thread();
 
 #ifdef KVEJKEN_DEBUG_PHYSICS
         static std::ofstream debug_file("physics_debug.txt");
@@ -516,8 +1268,8 @@ namespace kvejken::collision
         DEBUG_VAR(slide_threshold);
         debug_file << "\n";
 #else
-        static utils::NullStreamBuf null_buf;
-        static std::ostream debug_file(&null_buf);
+        thread_local utils::NullStreamBuf null_buf;
+        thread_local std::ostream debug_file(&null_buf);
 #endif
 
         bool any = false;
@@ -530,21 +1282,27 @@ namespace kvejken::collision
         DEBUG_VAR(ground_normal_y);
         debug_file << "\n";
 
-        BVHNode* node = &m_bvh_nodes[0];
-        static std::vector<BVHNode*> stack;
-        stack.clear();
+        struct StackEntry
+        {
+            uint32_t child;
+            uint32_t count;
+        };
+        StackEntry stack[BVH4_STACK_SIZE];
+        int stack_size = 0;
+        stack[stack_size++] = StackEntry{ 0, 0 };
 
-        static std::vector<std::pair<const Triangle*, float>> close_triangles;
+        thread_local std::vector<std::pair<const Triangle*, float>> close_triangles;
         close_triangles.clear();
 
-
-        while (node != nullptr)
+        while (stack_size > 0)
         {
-            if (node->is_leaf)
+            StackEntry entry = stack[--stack_size];
+
+            if (entry.count > 0)
             {
-                for (int i = node->left_child; i <= node->right_child; i++)
+                for (uint32_t i = entry.child; i < entry.child + entry.count; i++)
                 {
-                    const auto& tri = m_triangles[i];
+                    const auto& tri = m_tris[i];
                     if (auto collision = sphere_triangle_intersection(center, radius * 1.6f, tri.v1, tri.v2, tri.v3))
                     {
                         DEBUG_VECTOR(tri.v1);
@@ -554,50 +1312,21 @@ namespace kvejken::collision
                         close_triangles.push_back({ &tri, collision->depth });
                     }
                 }
-
-                if (stack.size() > 0)
-                {
-                    node = stack.back();
-                    stack.pop_back();
-                }
-                else
-                {
-                    node = nullptr;
-                }
+                continue;
             }
-            else
-            {
-                BVHNode* left = &m_bvh_nodes[node->left_child];
-                BVHNode* right = &m_bvh_nodes[node->right_child];
 
-                bool left_inside = sphere_aabb_intersection(left->bounds, center, radius * 1.6f); // malo vecji radij ker se center premika
-                bool right_inside = sphere_aabb_intersection(right->bounds, center, radius * 1.6f);
+            // malo vecji radij ker se center premika
+            const BVH4Node& node = m_nodes[entry.child];
+            int mask = sphere_aabb4_intersection(node, center, radius * 1.6f);
 
-                if (left_inside && right_inside)
-                {
-                    node = left;
-                    stack.push_back(right);
-                }
-                else if (left_inside)
-                {
-                    node = left;
-                }
-                else if (right_inside)
-                {
-                    node = right;
-                }
-                else if (stack.size() > 0)
-                {
-                    node = stack.back();
-                    stack.pop_back();
-                }
-                else
-                {
-                    node = nullptr;
-                }
+            // otroci od leve proti desni kot v binarnem drevesu, ker je sort trikotnikov spodaj nestabilen
+            for (int i = 3; i >= 0; i--)
+            {
+                if (mask & (1 << i))
+                    stack[stack_size++] = StackEntry{ node.child[i], node.count[i] };
             }
         }
-        
+
         for (const auto [sphere_collider, transform] : ecs::get_components<SphereCollider, Transform>())
         {
             glm::vec3 sphere_center = sphere_collider.center_offset + transform.position;
@@ -609,21 +1338,16 @@ namespace kvejken::collision
             }
         }
 
-        static std::vector<Triangle> temp_triangles;
-        temp_triangles.clear();
-
-        for (const auto [rect, transform] : ecs::get_components<RectCollider, Transform>())
+        for (const auto [id, rect, transform] : ecs::get_components_ids<RectCollider, Transform>())
         {
-            auto [t1, t2] = rect_to_tris(rect, transform);
+            const auto& [t1, t2] = cached_rect_tris(id);
             if (auto collision = sphere_triangle_intersection(center, radius * 1.6f, t1.v1, t1.v2, t1.v3))
             {
-                temp_triangles.push_back(t1);
-                close_triangles.push_back({ &temp_triangles.back(), collision->depth});
+                close_triangles.push_back({ &t1, collision->depth});
             }
             if (auto collision = sphere_triangle_intersection(center, radius * 1.6f, t2.v1, t2.v2, t2.v3))
             {
-                temp_triangles.push_back(t2);
-                close_triangles.push_back({ &temp_triangles.back(), collision->depth });
+                close_triangles.push_back({ &t2, collision->depth });
             }
         }
 
@@ -695,5 +1419,59 @@ namespace kvejken::collision
         debug_file << "no collision\n";
         return std::nullopt;
     }
+
+#ifdef KVEJKEN_BENCH_COLLISION
+    void benchmark_bvh()
+    {
+        join_bvh_build_thread();
+
+        constexpr int RAY_COUNT = 1'000'000;
+        constexpr int SPHERE_COUNT = 100'000;
+
+        // lasten generator, da benchmark ne spremeni stanja utils::randf
+        std::mt19937 generator(1);
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        // meje korena iz nepraznih otrok
+        AABB bounds = { glm::vec3(INFINITY), glm::vec3(-INFINITY) };
+        for (int i = 0; i < 4; i++)
+        {
+            if (m_nodes[0].min_x[i] == INFINITY)
+                continue;
+            bounds.min = glm::min(bounds.min, glm::vec3(m_nodes[0].min_x[i], m_nodes[0].min_y[i], m_nodes[0].min_z[i]));
+            bounds.max = glm::max(bounds.max, glm::vec3(m_nodes[0].max_x[i], m_nodes[0].max_y[i], m_nodes[0].max_z[i]));
+        }
+
+        std::vector<glm::vec3> positions(RAY_COUNT);
+        std::vector<glm::vec3> directions(RAY_COUNT);
+        for (int i = 0; i < RAY_COUNT; i++)
+        {
+            glm::vec3 t = glm::vec3(distribution(generator), distribution(generator), distribution(generator));
+            positions[i] = bounds.min + t * (bounds.max - bounds.min);
+            directions[i] = glm::normalize(glm::vec3(distribution(generator) - 0.5f, -0.3f - distribution(generator), distribution(generator) - 0.5f));
+        }
+
+        int hits = 0;
+        auto start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < RAY_COUNT; i++)
+        {
+            if (auto hit = raycast(positions[i], directions[i], 9999.0f, false))
+            {
+                positions[hits] = hit->position;
+                hits++;
+            }
+        }
+        std::chrono::duration<float, std::milli> raycast_ms = std::chrono::steady_clock::now() - start_time;
+
+        // sfere tik nad zadetki, da se res dotikajo terena
+        int sphere_count = std::min(SPHERE_COUNT, hits);
+        start_time = std::chrono::steady_clock::now();
+        for (int i = 0; i < sphere_count; i++)
+            sphere_collision(positions[i] + glm::vec3(0, 0.4f, 0), 0.5f, glm::vec3(0, -1, 0));
+        std::chrono::duration<float, std::milli> sphere_ms = std::chrono::steady_clock::now() - start_time;
+
+        printf("bvh benchmark: raycast %.3f Mrays/s (%d hits), sphere_collision %.3f Mcalls/s\n",
+            RAY_COUNT / raycast_ms.count() / 1000.0f, hits, sphere_count / sphere_ms.count() / 1000.0f);
+    }
+#endif
 }
 
@@ -7,6 +7,12 @@ namespace kvejken::collision
 {
     void build_triangle_bvh(const Model& model, glm::vec3 position, glm::quat rotation, glm::vec3 scale);
     void check_bvh_build_thread();
+#ifdef KVEJKEN_BENCH_COLLISION
+    // izmeri prepustnost raycast in sphere_collision na zgrajenem BVH
+    void benchmark_bvh();
+#endif
+    // posodobi cache trikotnikov za spremenjene RectCollider komponente in world matrike, klice se po update_world_transforms
+    void update_collider_cache();
 
     struct RectCollider
     {
@@ -35,6 +41,12 @@ namespace kvejken::collision
     };
     std::optional<RaycastHit> raycast(glm::vec3 position, glm::vec3 direction, float max_dist = 9999.0f, bool check_other_colliders = true);
 
+    // vec raycastov iz iste tocke, npr. steering enemyjev, za vsak ray enak rezultat kot raycast
+    // vsi rayi gredo skozi BVH hkrati, zato se vsak node in trikotnik nalozi in pripravi samo enkrat
+    constexpr int RAYCAST_BATCH_MAX = 32;
+    void raycast_batch(glm::vec3 position, const glm::vec3* directions, int count, float max_dist,
+        std::optional<RaycastHit>* out_hits, bool check_other_colliders = true);
+
     glm::vec3 closest_point_on_line(glm::vec3 a, glm::vec3 b, glm::vec3 p);
 
     struct Intersection
@@ -1,29 +1,545 @@
 ﻿#include "ECS.h"
 #include <vector>
 #include <iostream>
-#include <bitset>
-#include <unordered_map>
-#include <unordered_set>
+#include <cstddef>
+#include <mutex>
 
 namespace kvejken::ecs
 {
-    std::vector<IComponentPool*> m_component_pools;
-    std::unordered_map<Entity, std::bitset<32>> m_signatures;
-    std::unordered_set<Entity> m_to_destroy;
+    std::atomic_uint32_t m_query_slot_count = 0;
+
+    thread_local World* t_world = nullptr;
+    thread_local CommandBuffer* t_commands = nullptr;
+    thread_local World* t_commands_world = nullptr;
+
+    static World& default_world()
+    {
+        // se ne unici ob izhodu, komponente so lahko odvisne od drugih globalnih objektov
+        static World* world = new World();
+        return *world;
+    }
+
+    World& world()
+    {
+        return t_world != nullptr ? *t_world : default_world();
+    }
+
+    World* set_world(World* world)
+    {
+        World* prev = t_world;
+        t_world = world;
+        return prev;
+    }
+
+    World::~World()
+    {
+        for (IComponentPool* pool : component_pools)
+            delete pool;
+        for (Group* group : groups)
+            delete group;
+    }
 
     std::vector<IComponentPool*>& component_pools()
     {
-        return m_component_pools;
+        return world().component_pools;
     }
 
-    std::unordered_map<Entity, std::bitset<32>>& signatures()
+    EntityTable& entity_table()
     {
-        return m_signatures;
+        return world().entity_table;
     }
 
-    std::unordered_set<Entity>& to_destroy()
+    std::vector<Group*>& groups()
     {
-        return m_to_destroy;
+        return world().groups;
     }
-}
 
+    std::vector<std::vector<Query*>>& query_index()
+    {
+        return world().query_index;
+    }
+
+    uint32_t new_query_slot()
+    {
+        uint32_t slot = m_query_slot_count++;
+        ASSERT(slot < MAX_QUERIES);
+        return slot;
+    }
+
+    Query* find_query(uint32_t slot)
+    {
+        return world().query_slots[slot].load(std::memory_order_acquire);
+    }
+
+    static constexpr uint32_t NOT_IN_QUERY = 0xFFFFFFFF;
+
+    void update_query(Query& query, Entity entity)
+    {
+        uint32_t index = entity_index(entity);
+        if (index >= query.positions.size())
+            query.positions.resize(entity_table().generations.size(), NOT_IN_QUERY);
+
+        bool contained = query.positions[index] != NOT_IN_QUERY;
+        if (query.filter.matches(entity) == contained)
+            return;
+
+        if (!contained)
+        {
+            query.positions[index] = (uint32_t)query.entities.size();
+            query.entities.push_back(entity);
+        }
+        else
+        {
+            // zadnjo entiteto premakne na mesto odstranjene
+            uint32_t position = query.positions[index];
+            Entity last = query.entities.back();
+            query.entities[position] = last;
+            query.positions[entity_index(last)] = position;
+            query.entities.pop_back();
+            query.positions[index] = NOT_IN_QUERY;
+        }
+    }
+
+    static void fill_query(Query& query)
+    {
+        const EntityTable& table = entity_table();
+        query.entities.clear();
+        query.positions.assign(table.generations.size(), NOT_IN_QUERY);
+
+        // mrtve entitete imajo prazno signaturo, zato jih filter ne sprejme
+        for (uint32_t index = 0; index < table.generations.size(); index++)
+            update_query(query, make_entity(index, table.generations[index]));
+    }
+
+    Query* register_query(uint32_t slot, const std::vector<uint32_t>& required, const std::vector<uint32_t>& excluded)
+    {
+        World& world = ecs::world();
+
+        // prvic se lahko klice iz sistema na worker threadu, takrat se strukturne spremembe ne dogajajo
+        std::scoped_lock<std::mutex> lock(world.queries_mutex);
+        if (Query* query = world.query_slots[slot].load(std::memory_order_acquire))
+            return query;
+
+        world.queries.push_back(std::make_unique<Query>());
+        Query* query = world.queries.back().get();
+        for (uint32_t comp_id : required)
+            query->filter.require(comp_id);
+        for (uint32_t comp_id : excluded)
+            query->filter.exclude(comp_id);
+        fill_query(*query);
+
+        for (const std::vector<uint32_t>* comp_ids : { &required, &excluded })
+        {
+            for (uint32_t comp_id : *comp_ids)
+            {
+                if (comp_id >= world.query_index.size())
+                    world.query_index.resize(comp_id + 1);
+                std::vector<Query*>& list = world.query_index[comp_id];
+                if (std::find(list.begin(), list.end(), query) == list.end())
+                    list.push_back(query);
+            }
+        }
+
+        world.query_slots[slot].store(query, std::memory_order_release);
+        return query;
+    }
+
+    void rebuild_queries()
+    {
+        for (std::unique_ptr<Query>& query : world().queries)
+            fill_query(*query);
+    }
+
+    uint32_t tick()
+    {
+        return world().tick;
+    }
+
+    void advance_tick()
+    {
+        World& world = ecs::world();
+        world.tick++;
+        world.prev_structural_changes = world.structural_changes;
+        world.structural_changes = 0;
+    }
+
+    uint32_t& structural_changes()
+    {
+        return world().structural_changes;
+    }
+
+    Stats stats()
+    {
+        const World& world = ecs::world();
+
+        Stats stats;
+        for (IComponentPool* pool : world.component_pools)
+        {
+            if (pool != nullptr)
+                stats.pools.push_back(pool->stats());
+        }
+
+        const EntityTable& table = world.entity_table;
+        stats.entity_table_size = table.generations.size();
+        stats.entities_alive = table.generations.size() - table.free_indices.size();
+        stats.entity_table_bytes = table.generations.capacity() * sizeof(uint32_t) + table.free_indices.capacity() * sizeof(uint32_t);
+        stats.signature_bytes = table.signatures.capacity() * sizeof(uint64_t);
+        stats.signature_words = table.signature_words;
+        stats.structural_changes = world.prev_structural_changes;
+        return stats;
+    }
+
+    size_t Stats::total_bytes() const
+    {
+        size_t total = entity_table_bytes + signature_bytes;
+        for (const PoolStats& pool : pools)
+            total += pool.bytes_used + pool.bytes_wasted + pool.sparse_bytes;
+        return total;
+    }
+
+    std::atomic_int& structural_lock()
+    {
+        return world().structural_lock;
+    }
+
+    // worker thread lahko uporablja glavni buffer samo sveta, ki ga je sam nastavil
+    static bool owns_world()
+    {
+        return jobs::thread_index() == 0 || t_world != nullptr;
+    }
+
+    CommandBuffer& commands()
+    {
+        // buffer velja samo v svetu, v katerem je bil nastavljen, npr. ce worker med
+        // cakanjem na chunke izvede simulacijo drugega sveta
+        World& world = ecs::world();
+        if (t_commands != nullptr && t_commands_world == &world)
+            return *t_commands;
+
+        // worker threadi lahko zapisujejo samo v buffer sistema ali chunka
+        ASSERT(owns_world());
+        return world.commands;
+    }
+
+    CommandBuffer* set_commands(CommandBuffer* buffer)
+    {
+        CommandBuffer* prev = t_commands;
+        t_commands = buffer;
+        t_commands_world = &world();
+        return prev;
+    }
+
+    void execute_commands()
+    {
+        world().commands.execute();
+    }
+
+    std::vector<Entity> instantiate(const Prefab& prefab, size_t count, const std::function<void(Entity, size_t)>& init)
+    {
+        ASSERT(structural_changes_allowed());
+
+        std::vector<Entity> entities(count);
+        for (size_t i = 0; i < count; i++)
+            entities[i] = create_entity();
+        structural_changes() += (uint32_t)(count * prefab.components().size());
+
+        for (const Prefab::Component& component : prefab.components())
+        {
+            if (component.add != nullptr)
+                component.add(component.value.get(), entities.data(), count);
+        }
+
+        const std::vector<uint64_t>& mask = prefab.signature();
+        grow_signatures((uint32_t)mask.size());
+        for (Entity entity : entities)
+        {
+            uint64_t* sig = signature(entity);
+            for (size_t w = 0; w < mask.size(); w++)
+                sig[w] |= mask[w];
+        }
+
+        // komponente so dodane mimo add_component, zato je treba entitete se dodati v grupe in poizvedbe
+        World& world = ecs::world();
+        std::vector<Query*> touched_queries;
+        for (const Prefab::Component& component : prefab.components())
+        {
+            if (component.comp_id >= world.query_index.size())
+                continue;
+            for (Query* query : world.query_index[component.comp_id])
+            {
+                if (std::find(touched_queries.begin(), touched_queries.end(), query) == touched_queries.end())
+                    touched_queries.push_back(query);
+            }
+        }
+        for (Query* query : touched_queries)
+        {
+            for (Entity entity : entities)
+                update_query(*query, entity);
+        }
+
+        for (Group* group : world.groups)
+        {
+            bool touched = false;
+            for (const Prefab::Component& component : prefab.components())
+                touched |= std::find(group->comp_ids.begin(), group->comp_ids.end(), component.comp_id) != group->comp_ids.end();
+            if (!touched)
+                continue;
+
+            for (Entity entity : entities)
+            {
+                if (matches_group(*group, entity))
+                    enter_group(*group, entity);
+            }
+        }
+
+        // observerji morajo videti vrednosti instance, ne privzetih iz prefaba
+        if (init)
+        {
+            for (size_t i = 0; i < count; i++)
+                init(entities[i], i);
+        }
+
+        for (const Prefab::Component& component : prefab.components())
+        {
+            if (component.constructed != nullptr)
+                component.constructed(entities.data(), count);
+        }
+
+        return entities;
+    }
+
+    static constexpr uint32_t SNAPSHOT_MAGIC = 0x4E53564B; // "KVSN"
+    static constexpr uint32_t SNAPSHOT_VERSION = 1;
+
+    std::vector<uint8_t> snapshot()
+    {
+        ASSERT(owns_world() && structural_changes_allowed());
+        static_assert(std::is_trivially_copyable_v<std::mt19937>);
+
+        World& world = ecs::world();
+        EntityTable& table = world.entity_table;
+        std::vector<IComponentPool*>& pools = world.component_pools;
+
+        std::vector<uint8_t> blob;
+        write_value(blob, SNAPSHOT_MAGIC);
+        write_value(blob, SNAPSHOT_VERSION);
+        write_value(blob, utils::int_generator());
+        write_value(blob, utils::float_generator());
+
+        write_vector(blob, table.generations);
+        write_vector(blob, table.free_indices);
+        write_vector(blob, table.signatures);
+        write_value(blob, table.signature_words);
+
+        uint32_t pool_count = 0;
+        for (IComponentPool* pool : pools)
+        {
+            if (pool != nullptr)
+                pool_count++;
+        }
+        write_value(blob, pool_count);
+
+        for (uint32_t comp_id = 0; comp_id < pools.size(); comp_id++)
+        {
+            if (pools[comp_id] == nullptr)
+                continue;
+            write_value(blob, comp_id);
+            pools[comp_id]->save(blob);
+        }
+
+        return blob;
+    }
+
+    void restore(const std::vector<uint8_t>& blob)
+    {
+        ASSERT(owns_world() && structural_changes_allowed());
+        World& world = ecs::world();
+        EntityTable& table = world.entity_table;
+        std::vector<IComponentPool*>& pools = world.component_pools;
+        const uint8_t* data = blob.data();
+
+        uint32_t magic, version;
+        read_value(data, magic);
+        read_value(data, version);
+        ASSERT(magic == SNAPSHOT_MAGIC && version == SNAPSHOT_VERSION);
+        read_value(data, utils::int_generator());
+        read_value(data, utils::float_generator());
+
+        read_vector(data, table.generations);
+        read_vector(data, table.free_indices);
+        read_vector(data, table.signatures);
+        read_value(data, table.signature_words);
+
+        uint32_t pool_count;
+        read_value(data, pool_count);
+
+        std::vector<bool> loaded(pools.size(), false);
+        for (uint32_t i = 0; i < pool_count; i++)
+        {
+            uint32_t comp_id;
+            read_value(data, comp_id);
+            // id komponent se ne spreminjajo med zagonom, pooli pa se nikoli ne brisejo,
+            // zato se snapshot obnovi samo v svet, ki je ze imel vse te poole
+            ASSERT(comp_id < pools.size() && pools[comp_id] != nullptr);
+            pools[comp_id]->load(data);
+            loaded[comp_id] = true;
+        }
+        ASSERT(data == blob.data() + blob.size());
+
+        for (uint32_t comp_id = 0; comp_id < pools.size(); comp_id++)
+        {
+            if (pools[comp_id] != nullptr && !loaded[comp_id])
+                pools[comp_id]->clear();
+        }
+
+        for (Group* group : world.groups)
+            rebuild_group(*group);
+        rebuild_queries();
+
+        structural_changes()++;
+    }
+
+    CommandBuffer::~CommandBuffer()
+    {
+        clear();
+        for (uint8_t* block : m_blocks)
+            delete[] block;
+    }
+
+    Entity CommandBuffer::create_entity()
+    {
+        ASSERT(m_created_count < ENTITY_INDEX_MASK);
+        Entity placeholder = make_placeholder(m_created_count++);
+        push(CommandType::CreateEntity, placeholder, nullptr);
+        return placeholder;
+    }
+
+    void CommandBuffer::destroy_entity(Entity entity)
+    {
+        push(CommandType::DestroyEntity, entity, nullptr);
+    }
+
+    CommandBuffer::Command& CommandBuffer::push(CommandType type, Entity entity, const ComponentOps* ops)
+    {
+        // execute tece po m_commands, nov ukaz bi lahko realociral vektor
+        ASSERT(!m_executing);
+
+        Command command;
+        command.type = type;
+        command.entity = entity;
+        command.ops = ops;
+        command.data = nullptr;
+        if (type == CommandType::AddComponent || type == CommandType::Instantiate)
+            command.data = allocate(ops->size, ops->alignment);
+
+        m_commands.push_back(command);
+        return m_commands.back();
+    }
+
+    void* CommandBuffer::allocate(size_t size, size_t alignment)
+    {
+        ASSERT(size <= BLOCK_SIZE && alignment <= alignof(std::max_align_t));
+
+        m_block_offset = (m_block_offset + alignment - 1) & ~(alignment - 1);
+        if (m_block < m_blocks.size() && m_block_offset + size > BLOCK_SIZE)
+        {
+            m_block++;
+            m_block_offset = 0;
+        }
+        if (m_block == m_blocks.size())
+            m_blocks.push_back(new uint8_t[BLOCK_SIZE]);
+
+        void* ptr = m_blocks[m_block] + m_block_offset;
+        m_block_offset += size;
+        return ptr;
+    }
+
+    Entity CommandBuffer::resolve(Entity entity) const
+    {
+        if (is_placeholder(entity))
+            return m_created[entity_index(entity)];
+        return entity;
+    }
+
+    void CommandBuffer::execute()
+    {
+        ASSERT(structural_changes_allowed());
+
+        m_created.assign(m_created_count, NULL_ENTITY);
+        m_executing = true;
+
+        for (Command& command : m_commands)
+        {
+            switch (command.type)
+            {
+            case CommandType::CreateEntity:
+                m_created[entity_index(command.entity)] = ecs::create_entity();
+                break;
+
+            case CommandType::DestroyEntity:
+                ecs::destroy_entity(resolve(command.entity));
+                break;
+
+            case CommandType::AddComponent:
+            {
+                Entity entity = resolve(command.entity);
+                if (is_alive(entity))
+                    command.ops->add(command.data, entity);
+                break;
+            }
+
+            case CommandType::RemoveComponent:
+            {
+                Entity entity = resolve(command.entity);
+                if (is_alive(entity))
+                    command.ops->remove(entity);
+                break;
+            }
+
+            case CommandType::Instantiate:
+            {
+                const Instantiation& instantiation = *(Instantiation*)command.data;
+                ecs::instantiate(*instantiation.prefab, instantiation.count, instantiation.init);
+                break;
+            }
+            }
+        }
+
+        m_executing = false;
+        clear();
+    }
+
+    void CommandBuffer::append(CommandBuffer& other)
+    {
+        for (const Command& command : other.m_commands)
+        {
+            Entity entity = command.entity;
+            if (is_placeholder(entity))
+                entity = make_placeholder(entity_index(entity) + m_created_count);
+
+            Command& moved = push(command.type, entity, command.ops);
+            if (command.data != nullptr)
+                command.ops->relocate(moved.data, command.data);
+        }
+        m_created_count += other.m_created_count;
+
+        // komponente so ze premaknjene
+        other.m_commands.clear();
+        other.clear();
+    }
+
+    void CommandBuffer::clear()
+    {
+        // komponente, ki niso bile dodane (ali so bile premaknjene iz njih), je treba se unicit
+        for (Command& command : m_commands)
+        {
+            if (command.data != nullptr)
+                command.ops->destroy(command.data);
+        }
+
+        m_commands.clear();
+        m_created_count = 0;
+        m_block = 0;
+        m_block_offset = 0;
+    }
+}
@@ -1,726 +1,1997 @@
 ﻿#pragma once
 #include "Utils.h"
+#include "Jobs.h"
 #include <vector>
-#include <bitset>
 #include <unordered_map>
-#include <unordered_set>
+#include <algorithm>
+#include <tuple>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <new>
+#include <typeinfo>
+#include <initializer_list>
+#include <mutex>
+#include <functional>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace kvejken
 {
+    // spodnji biti so index v tabeli entitet, zgornji pa generacija,
+    // ki se poveca vsakic ko je index unicen, da lahko zaznamo stare entitete
     using Entity = uint32_t;
+    constexpr Entity NULL_ENTITY = (Entity)-1;
+
+    namespace ecs
+    {
+        constexpr uint32_t ENTITY_INDEX_BITS = 22;
+        constexpr uint32_t ENTITY_INDEX_MASK = (1u << ENTITY_INDEX_BITS) - 1;
+        constexpr uint32_t ENTITY_GENERATION_MASK = (1u << (32 - ENTITY_INDEX_BITS)) - 1;
+
+        inline uint32_t entity_index(Entity entity) { return entity & ENTITY_INDEX_MASK; }
+        inline uint32_t entity_generation(Entity entity) { return entity >> ENTITY_INDEX_BITS; }
+        inline Entity make_entity(uint32_t index, uint32_t generation) { return (generation << ENTITY_INDEX_BITS) | index; }
+
+        constexpr uint32_t INVALID_INDEX = (uint32_t)-1;
+
+        // entitete iz CommandBuffer::create_entity imajo rezervirano generacijo,
+        // index pa je zaporedna stevilka v bufferju
+        inline Entity make_placeholder(uint32_t index) { return make_entity(index, ENTITY_GENERATION_MASK); }
+        inline bool is_placeholder(Entity entity) { return entity != NULL_ENTITY && entity_generation(entity) == ENTITY_GENERATION_MASK; }
+
+        // stevilo komponent v bloku je enako za vse poole, da se bloki poolov v grupi poravnajo
+        constexpr size_t COMPONENT_BLOCK_SHIFT = 9;
+        constexpr size_t COMPONENT_BLOCK_SIZE = (size_t)1 << COMPONENT_BLOCK_SHIFT;
+        constexpr size_t COMPONENT_BLOCK_MASK = COMPONENT_BLOCK_SIZE - 1;
+
+        // owning grupa: entitete, ki imajo vse komponente grupe, so v vseh poolih grupe
+        // zbrane na zacetku (indeksi [0, size)) in v istem vrstnem redu
+        struct Group
+        {
+            std::vector<uint32_t> comp_ids;
+            uint32_t size = 0;
+        };
+
+        struct PoolStats
+        {
+            const char* name;
+            size_t live;
+            size_t capacity;
+            size_t peak;
+            size_t bytes_used; // komponente, entitete in verzije zivih komponent
+            size_t bytes_wasted; // rezerviran, a neuporabljen prostor
+            size_t sparse_bytes; // alocirane strani sparse dela
+        };
+
+        // vse stanje ECS (entitete, pooli, grupe, poizvedbe, glavni buffer) je v svetu
+        // vsak thread dela s svojim trenutnim svetom, privzeto je to globalni svet igre
+        class World;
+        World& world();
+        // vrne prejsnji svet, nullptr pomeni globalni svet
+        // sistemi in chunki parallel_for_chunks dobijo svet threada, ki jih je zagnal
+        World* set_world(World* world);
+
+        // stevec framov, s katerim so oznacene spremembe komponent (zacne se z 1)
+        uint32_t tick();
+        void advance_tick();
+
+        // stevilo create/destroy entitet in add/remove komponent v trenutnem framu
+        uint32_t& structural_changes();
+
+        // vecje od 0 med parallel_each, takrat create/destroy entitet in add/remove komponent ni dovoljeno
+        std::atomic_int& structural_lock();
+
+        inline bool structural_changes_allowed()
+        {
+            return structural_lock() == 0;
+        }
+
+        struct EntityTable;
+        EntityTable& entity_table();
+
+        // razdeli [0, count) na chunke in jih izvede na worker threadih, func(begin, end)
+        template<typename Func>
+        inline void parallel_for_chunks(size_t count, size_t min_chunk_size, Func&& func);
+
+        // pomozne funkcije za binarne snapshote, data se premika naprej
+        inline void write_bytes(std::vector<uint8_t>& blob, const void* src, size_t size)
+        {
+            size_t offset = blob.size();
+            blob.resize(offset + size);
+            if (size > 0)
+                std::memcpy(blob.data() + offset, src, size);
+        }
+
+        inline void read_bytes(const uint8_t*& data, void* dst, size_t size)
+        {
+            if (size > 0)
+                std::memcpy(dst, data, size);
+            data += size;
+        }
+
+        template<typename T>
+        inline void write_value(std::vector<uint8_t>& blob, const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            write_bytes(blob, &value, sizeof(T));
+        }
+
+        template<typename T>
+        inline void read_value(const uint8_t*& data, T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            read_bytes(data, &value, sizeof(T));
+        }
+
+        template<typename T>
+        inline void write_vector(std::vector<uint8_t>& blob, const std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            write_value(blob, (uint64_t)values.size());
+            write_bytes(blob, values.data(), values.size() * sizeof(T));
+        }
+
+        template<typename T>
+        inline void read_vector(const uint8_t*& data, std::vector<T>& values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            uint64_t count;
+            read_value(data, count);
+            values.resize(count);
+            read_bytes(data, values.data(), count * sizeof(T));
+        }
+    }
 
     class IComponentPool
     {
     public:
+        virtual ~IComponentPool() {}
+
         virtual bool has_component(Entity entity) const = 0;
         virtual void remove_component(Entity entity) = 0;
+        virtual uint32_t sparse_index(Entity entity) const = 0;
+        virtual void swap_slots(uint32_t a, uint32_t b) = 0;
 
         virtual size_t size() const = 0;
+        virtual Entity entity_at(size_t index) const = 0;
         virtual const char* component_name() const = 0;
+        virtual ecs::PoolStats stats() const = 0;
+
+        // snapshot: entitete in komponente, sparse del se ob load zgradi na novo
+        virtual void save(std::vector<uint8_t>& blob) const = 0;
+        virtual void load(const uint8_t*& data) = 0;
+        virtual void clear() = 0;
+
+        ecs::Group* group() const { return m_group; }
+        void set_group(ecs::Group* group) { m_group = group; }
+
+    private:
+        ecs::Group* m_group = nullptr;
     };
 
+    // komponente so v blokih fiksne velikosti, zato se ob dodajanju nikoli ne premaknejo
+    // in ni kopiranja vseh komponent, ko bi std::vector moral povecati kapaciteto
+    // naslov se spremeni samo ob remove (zadnja komponenta zapolni luknjo) in ob premikih v grupi
     template<typename T>
-    class ComponentPool : public IComponentPool
+    class ComponentStorage
     {
     public:
+        static constexpr size_t BLOCK_SHIFT = ecs::COMPONENT_BLOCK_SHIFT;
+        static constexpr size_t BLOCK_SIZE = ecs::COMPONENT_BLOCK_SIZE;
+        static constexpr size_t BLOCK_MASK = ecs::COMPONENT_BLOCK_MASK;
+
+        ComponentStorage() {}
+        ComponentStorage(const ComponentStorage& other) = delete;
+        ComponentStorage& operator=(const ComponentStorage& other) = delete;
+
+        ~ComponentStorage()
+        {
+            clear();
+            for (T* block : m_blocks)
+                ::operator delete(block, std::align_val_t(alignof(T)));
+        }
+
+        class Iterator
+        {
+        public:
+            Iterator(ComponentStorage* storage, size_t index)
+            {
+                m_storage = storage;
+                m_index = index;
+                m_ptr = index < storage->size() ? &(*storage)[index] : nullptr;
+            }
+
+            T& operator*() const { return *m_ptr; }
+            T* operator->() const { return m_ptr; }
+
+            // znotraj bloka samo premakne kazalec
+            Iterator& operator++()
+            {
+                m_index++;
+                if ((m_index & BLOCK_MASK) != 0)
+                    m_ptr++;
+                else
+                    m_ptr = m_index < m_storage->size() ? m_storage->block(m_index >> BLOCK_SHIFT) : nullptr;
+                return *this;
+            }
+
+            bool operator==(const Iterator& b) const { return m_index == b.m_index; }
+            bool operator!=(const Iterator& b) const { return m_index != b.m_index; }
+
+        private:
+            ComponentStorage* m_storage;
+            size_t m_index;
+            T* m_ptr;
+        };
+
+        Iterator begin() { return Iterator(this, 0); }
+        Iterator end() { return Iterator(this, m_size); }
+
+        T& operator[](size_t index) { return m_blocks[index >> BLOCK_SHIFT][index & BLOCK_MASK]; }
+        const T& operator[](size_t index) const { return m_blocks[index >> BLOCK_SHIFT][index & BLOCK_MASK]; }
+        T& back() { return (*this)[m_size - 1]; }
+
+        void push_back(T value)
+        {
+            reserve(m_size + 1);
+            new (&(*this)[m_size]) T(std::move(value));
+            m_size++;
+        }
+
+        void pop_back()
+        {
+            m_size--;
+            (*this)[m_size].~T();
+        }
+
+        // nove komponente so value-initialized
+        void resize(size_t size)
+        {
+            reserve(size);
+            while (m_size > size)
+                pop_back();
+            for (; m_size < size; m_size++)
+                new (&(*this)[m_size]) T();
+        }
+
+        void assign(size_t size, const T& value)
+        {
+            clear();
+            reserve(size);
+            for (; m_size < size; m_size++)
+                new (&(*this)[m_size]) T(value);
+        }
+
+        // bloki ostanejo alocirani
+        void clear()
+        {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+            {
+                for (size_t i = 0; i < m_size; i++)
+                    (*this)[i].~T();
+            }
+            m_size = 0;
+        }
+
+        void reserve(size_t capacity)
+        {
+            while (m_blocks.size() * BLOCK_SIZE < capacity)
+                m_blocks.push_back((T*)::operator new(BLOCK_SIZE * sizeof(T), std::align_val_t(alignof(T))));
+        }
+
+        size_t size() const { return m_size; }
+        size_t capacity() const { return m_blocks.size() * BLOCK_SIZE; }
+
+        // bloki, ki vsebujejo vsaj eno komponento
+        size_t block_count() const { return (m_size + BLOCK_MASK) >> BLOCK_SHIFT; }
+        size_t block_length(size_t block) const { return std::min(BLOCK_SIZE, m_size - block * BLOCK_SIZE); }
+        T* block(size_t block) { return m_blocks[block]; }
+        const T* block(size_t block) const { return m_blocks[block]; }
+
+    private:
+        std::vector<T*> m_blocks;
+        size_t m_size = 0;
+    };
+
+    namespace ecs
+    {
+        // zapis komponent poola v snapshot, privzeto en memcpy za vsak blok
+        // komponente z npr. std::vector morajo specializirati ta template takoj za definicijo komponente,
+        // sicer snapshot() z njimi ne deluje
+        template<typename T>
+        struct ComponentSerializer
+        {
+            static void save(std::vector<uint8_t>& blob, const ComponentStorage<T>& comps)
+            {
+                if constexpr (std::is_trivially_copyable_v<T>)
+                {
+                    write_value(blob, (uint64_t)comps.size());
+                    for (size_t b = 0; b < comps.block_count(); b++)
+                        write_bytes(blob, comps.block(b), comps.block_length(b) * sizeof(T));
+                }
+                else
+                {
+                    ERROR_EXIT("komponenta %s nima ComponentSerializer", typeid(T).name());
+                }
+            }
+
+            static void load(const uint8_t*& data, ComponentStorage<T>& comps)
+            {
+                if constexpr (std::is_trivially_copyable_v<T>)
+                {
+                    uint64_t count;
+                    read_value(data, count);
+                    comps.resize(count);
+                    for (size_t b = 0; b < comps.block_count(); b++)
+                        read_bytes(data, comps.block(b), comps.block_length(b) * sizeof(T));
+                }
+                else
+                {
+                    ERROR_EXIT("komponenta %s nima ComponentSerializer", typeid(T).name());
+                }
+            }
+        };
+
+        // observerji komponente v enem poolu, func(Entity, T&) se klice za vsako entiteto posebej
+        // brez observerjev je cena samo preverjanje empty()
+        template<typename T>
+        class Signal
+        {
+        public:
+            using Func = std::function<void(Entity, T&)>;
+
+            // vrne id za disconnect
+            uint32_t connect(Func func)
+            {
+                m_observers.push_back({ m_next_id, std::move(func) });
+                return m_next_id++;
+            }
+
+            void disconnect(uint32_t id)
+            {
+                m_observers.erase(std::remove_if(m_observers.begin(), m_observers.end(),
+                    [&](const auto& observer) { return observer.first == id; }), m_observers.end());
+            }
+
+            bool empty() const { return m_observers.empty(); }
+
+            void emit(Entity entity, T& comp) const
+            {
+                for (const auto& [id, func] : m_observers)
+                    func(entity, comp);
+            }
+
+        private:
+            std::vector<std::pair<uint32_t, Func>> m_observers;
+            uint32_t m_next_id = 0;
+        };
+    }
+
+    // sparse set: entity -> index v gostem nizu komponent
+    // sparse del je razdeljen na strani, da ne rabimo alocirati za vsako entiteto posebej
+    // in da so prazne strani skupne (kazejo na isto stran polno INVALID_INDEX)
+    template<typename T>
+    class ComponentPool final : public IComponentPool
+    {
+    public:
+        static constexpr uint32_t PAGE_SIZE = 4096;
+        static constexpr uint32_t INVALID_INDEX = ecs::INVALID_INDEX;
+
         ComponentPool() {}
         ComponentPool(const ComponentPool& other) = delete;
         ComponentPool& operator=(const ComponentPool& other) = delete;
 
-        void add_component(const T& comp, Entity entity)
+        ~ComponentPool()
         {
-            uint32_t index = m_components.size();
-            m_components.push_back(comp);
+            for (uint32_t* page : m_sparse_pages)
+            {
+                if (page != empty_page())
+                    delete[] page;
+            }
+        }
+
+        void add_component(T comp, Entity entity)
+        {
+            uint32_t& slot = sparse_slot(entity);
+            ASSERT(slot == INVALID_INDEX); // assert da se ni obstajal
+
+            slot = m_components.size();
+            m_components.push_back(std::move(comp));
             m_index_to_entity.push_back(entity);
-            auto result = m_entity_to_index.insert({ entity, index });
-            ASSERT(result.second); // assert da se ni obstajal
+            m_versions.push_back(ecs::tick()); // nova komponenta steje kot spremenjena
+            m_peak = std::max(m_peak, m_components.size());
+        }
+
+        void reserve(size_t capacity)
+        {
+            m_components.reserve(capacity);
+            m_index_to_entity.reserve(capacity);
+            m_versions.reserve(capacity);
         }
 
         T& get_component(Entity entity)
         {
-            auto it = m_entity_to_index.find(entity);
-            ASSERT(it != m_entity_to_index.end());
-            return m_components[it->second];
+            uint32_t index = index_of(entity);
+            ASSERT(index != INVALID_INDEX);
+            return m_components[index];
         }
 
         T* try_get_component(Entity entity)
         {
-            auto it = m_entity_to_index.find(entity);
-            if (it == m_entity_to_index.end())
+            uint32_t index = index_of(entity);
+            if (index == INVALID_INDEX)
                 return nullptr;
-            return &m_components[it->second];
+            return &m_components[index];
         }
 
         bool has_component(Entity entity) const override
         {
-            return m_entity_to_index.count(entity) > 0;
+            return index_of(entity) != INVALID_INDEX;
         }
 
         void remove_component(Entity entity) override
         {
-            auto it = m_entity_to_index.find(entity);
-            ASSERT(it != m_entity_to_index.end());
-            uint32_t index = it->second;
+            ASSERT(has_component(entity));
+            uint32_t& slot = sparse_slot(entity);
+            uint32_t index = slot;
+
+            // tudi ob destroy_entity, takrat je signatura entitete ze prazna
+            if (!m_on_destroy.empty())
+                m_on_destroy.emit(entity, m_components[index]);
+            slot = INVALID_INDEX;
 
-            Entity last = m_index_to_entity[m_components.size() - 1];
-            m_entity_to_index[last] = index;
-            m_index_to_entity[index] = last;
-            m_entity_to_index.erase(entity);
+            uint32_t last_index = m_components.size() - 1;
+            if (index != last_index)
+            {
+                Entity last = m_index_to_entity[last_index];
+                sparse_slot(last) = index;
+                m_index_to_entity[index] = last;
+                m_components[index] = std::move(m_components[last_index]);
+                m_versions[index] = m_versions[last_index];
+            }
 
-            m_components[index] = std::move(m_components.back());
             m_components.pop_back();
             m_index_to_entity.pop_back();
+            m_versions.pop_back();
+        }
+
+        // verzija je tick zadnje spremembe, spremembe je treba oznaciti rocno
+        // on_update se izvede na threadu, ki je oznacil spremembo (lahko med parallel_each)
+        void mark_changed(Entity entity)
+        {
+            uint32_t index = index_of(entity);
+            ASSERT(index != INVALID_INDEX);
+            mark_changed_at(index);
+        }
+
+        void mark_changed_at(size_t index)
+        {
+            m_versions[index] = ecs::tick();
+            if (!m_on_update.empty())
+                m_on_update.emit(m_index_to_entity[index], m_components[index]);
+        }
+        uint32_t version_at(size_t index) const { return m_versions[index]; }
+
+        bool changed_since(Entity entity, uint32_t tick) const
+        {
+            uint32_t index = index_of(entity);
+            return index != INVALID_INDEX && m_versions[index] >= tick;
+        }
+
+        // func(Entity, T&) za komponente spremenjene na ali po ticku
+        // za sprotno posodabljanje cachev: since = ecs::tick() ob prejsnjem klicu
+        template<typename Func>
+        void each_changed_since(uint32_t tick, Func&& func)
+        {
+            for (size_t i = 0; i < m_components.size(); i++)
+            {
+                if (m_versions[i] >= tick)
+                    func(m_index_to_entity[i], m_components[i]);
+            }
+        }
+
+        // vrne INVALID_INDEX ce entiteta nima komponente
+        // ali ce je handle star (index je bil ze ponovno uporabljen)
+        uint32_t index_of(Entity entity) const
+        {
+            uint32_t index = sparse_index(entity);
+            if (index == INVALID_INDEX || m_index_to_entity[index] != entity)
+                return INVALID_INDEX;
+            return index;
+        }
+
+        // ne preveri generacije, zato samo za entitete za katere vemo da so zive
+        // (npr. ker smo jih dobili iz drugega poola)
+        uint32_t sparse_index(Entity entity) const override
+        {
+            uint32_t page = ecs::entity_index(entity) / PAGE_SIZE;
+            if (page >= m_sparse_pages.size())
+                return INVALID_INDEX;
+            return m_sparse_pages[page][ecs::entity_index(entity) % PAGE_SIZE];
+        }
+
+        void swap_slots(uint32_t a, uint32_t b) override
+        {
+            if (a == b)
+                return;
+
+            sparse_slot(m_index_to_entity[a]) = b;
+            sparse_slot(m_index_to_entity[b]) = a;
+            std::swap(m_index_to_entity[a], m_index_to_entity[b]);
+            std::swap(m_components[a], m_components[b]);
+            std::swap(m_versions[a], m_versions[b]);
         }
 
-        typename std::vector<T>::iterator begin() { return m_components.begin(); }
-        typename std::vector<T>::iterator end() { return m_components.end(); }
+        typename ComponentStorage<T>::Iterator begin() { return m_components.begin(); }
+        typename ComponentStorage<T>::Iterator end() { return m_components.end(); }
 
-        Entity entity_at(size_t index) { return m_index_to_entity[index]; }
+        Entity entity_at(size_t index) const override { return m_index_to_entity[index]; }
+        const ComponentStorage<Entity>& entities() const { return m_index_to_entity; }
         T& component_at(size_t index) { return m_components[index]; }
+        T* block(size_t block) { return m_components.block(block); }
         size_t size() const override { return m_components.size(); }
 
         const char* component_name() const override { return typeid(T).name(); }
 
+        // on_construct se izvede, ko je komponenta ze v poolu, signaturi in grupi
+        ecs::Signal<T>& on_construct() { return m_on_construct; }
+        ecs::Signal<T>& on_destroy() { return m_on_destroy; }
+        ecs::Signal<T>& on_update() { return m_on_update; }
+
+        ecs::PoolStats stats() const override
+        {
+            constexpr size_t slot_bytes = sizeof(T) + sizeof(Entity) + sizeof(uint32_t);
+
+            size_t allocated_pages = 0;
+            for (uint32_t* page : m_sparse_pages)
+            {
+                if (page != empty_page())
+                    allocated_pages++;
+            }
+
+            ecs::PoolStats stats;
+            stats.name = component_name();
+            stats.live = m_components.size();
+            stats.capacity = m_components.capacity();
+            stats.peak = m_peak;
+            stats.bytes_used = m_components.size() * slot_bytes;
+            stats.bytes_wasted = (m_components.capacity() - m_components.size()) * sizeof(T) // vkljucno s praznimi bloki
+                + (m_index_to_entity.capacity() - m_index_to_entity.size()) * sizeof(Entity)
+                + (m_versions.capacity() - m_versions.size()) * sizeof(uint32_t);
+            stats.sparse_bytes = allocated_pages * PAGE_SIZE * sizeof(uint32_t) + m_sparse_pages.capacity() * sizeof(uint32_t*);
+            return stats;
+        }
+
+        void save(std::vector<uint8_t>& blob) const override
+        {
+            ecs::ComponentSerializer<Entity>::save(blob, m_index_to_entity);
+            ecs::ComponentSerializer<T>::save(blob, m_components);
+        }
+
+        // vse nalozene komponente stejejo kot spremenjene, da se cachei posodobijo
+        // observerji dobijo on_destroy za stare in on_construct za nove komponente,
+        // ostali pooli so lahko takrat se neobnovljeni
+        void load(const uint8_t*& data) override
+        {
+            clear();
+            ecs::ComponentSerializer<Entity>::load(data, m_index_to_entity);
+            ecs::ComponentSerializer<T>::load(data, m_components);
+            ASSERT(m_components.size() == m_index_to_entity.size());
+
+            m_versions.assign(m_components.size(), ecs::tick());
+            for (size_t i = 0; i < m_index_to_entity.size(); i++)
+                sparse_slot(m_index_to_entity[i]) = (uint32_t)i;
+            m_peak = std::max(m_peak, m_components.size());
+
+            if (!m_on_construct.empty())
+            {
+                for (size_t i = 0; i < m_components.size(); i++)
+                    m_on_construct.emit(m_index_to_entity[i], m_components[i]);
+            }
+        }
+
+        // strani sparse dela ostanejo alocirane
+        void clear() override
+        {
+            if (!m_on_destroy.empty())
+            {
+                for (size_t i = 0; i < m_components.size(); i++)
+                    m_on_destroy.emit(m_index_to_entity[i], m_components[i]);
+            }
+
+            for (uint32_t* page : m_sparse_pages)
+            {
+                if (page != empty_page())
+                    std::fill_n(page, PAGE_SIZE, INVALID_INDEX);
+            }
+            m_index_to_entity.clear();
+            m_components.clear();
+            m_versions.clear();
+        }
+
     private:
-        std::unordered_map<Entity, uint32_t> m_entity_to_index;
-        std::vector<Entity> m_index_to_entity;
-        std::vector<T> m_components;
+        static uint32_t* empty_page()
+        {
+            static uint32_t* page = [] {
+                uint32_t* p = new uint32_t[PAGE_SIZE];
+                std::fill_n(p, PAGE_SIZE, INVALID_INDEX);
+                return p;
+            }();
+            return page;
+        }
+
+        // ustvari stran ce je se ni
+        uint32_t& sparse_slot(Entity entity)
+        {
+            uint32_t page = ecs::entity_index(entity) / PAGE_SIZE;
+            if (page >= m_sparse_pages.size())
+                m_sparse_pages.resize(page + 1, empty_page());
+
+            if (m_sparse_pages[page] == empty_page())
+            {
+                m_sparse_pages[page] = new uint32_t[PAGE_SIZE];
+                std::fill_n(m_sparse_pages[page], PAGE_SIZE, INVALID_INDEX);
+            }
+
+            return m_sparse_pages[page][ecs::entity_index(entity) % PAGE_SIZE];
+        }
+
+        std::vector<uint32_t*> m_sparse_pages;
+        ComponentStorage<Entity> m_index_to_entity;
+        ComponentStorage<T> m_components;
+        ComponentStorage<uint32_t> m_versions;
+        size_t m_peak = 0;
+
+        ecs::Signal<T> m_on_construct;
+        ecs::Signal<T> m_on_destroy;
+        ecs::Signal<T> m_on_update;
     };
 
-    template<typename T1>
-    class ComponentPoolCollectionIds1
+    namespace ecs
+    {
+        inline uint32_t new_component_id()
+        {
+            static std::atomic_uint32_t id = 0;
+            return id++;
+        }
+
+        template<typename T>
+        inline uint32_t component_id()
+        {
+            static uint32_t comp_id = new_component_id();
+            return comp_id;
+        }
+
+        // prazne komponente (npr. Fireplace{}) nimajo poola, so samo bit v signaturi entitete
+        // v querijih se uporabljajo z with/without/any_of
+        template<typename T>
+        constexpr bool is_tag_v = std::is_empty_v<T>;
+
+        // pogoji nad signaturo entitete, preverijo se preden se dostopa do komponent
+        // maske so po 64 bitnih besedah kot signature
+        class Filter
+        {
+        public:
+            void require(uint32_t comp_id) { set_bit(m_with, comp_id); }
+            void exclude(uint32_t comp_id) { set_bit(m_without, comp_id); }
+
+            void require_any(std::initializer_list<uint32_t> comp_ids)
+            {
+                m_any_of.emplace_back();
+                for (uint32_t comp_id : comp_ids)
+                    set_bit(m_any_of.back(), comp_id);
+            }
+
+            bool empty() const { return m_with.empty() && m_without.empty() && m_any_of.empty(); }
+            inline bool matches(Entity entity) const;
+
+        private:
+            static void set_bit(std::vector<uint64_t>& mask, uint32_t comp_id)
+            {
+                if (comp_id / 64 >= mask.size())
+                    mask.resize(comp_id / 64 + 1, 0);
+                mask[comp_id / 64] |= (uint64_t)1 << (comp_id % 64);
+            }
+
+            // tabela trenutnega sveta ob nastanku viewa, da ni treba klicati entity_table() za vsako entiteto
+            // view zato velja samo za svet, v katerem je bil ustvarjen
+            const EntityTable* m_table = &entity_table();
+            std::vector<uint64_t> m_with;
+            std::vector<uint64_t> m_without;
+            std::vector<std::vector<uint64_t>> m_any_of;
+        };
+    }
+
+    // iterira cez entitete, ki imajo vse komponente Ts...
+    // vedno gre cez najmanjsi pool, v ostalih pa samo preveri ali entiteta obstaja
+    // with/without/any_of dodajo pogoje za komponente, ki jih ne rabimo (npr. tage)
+    template<bool WithIds, typename... Ts>
+    class ComponentView
     {
     public:
-        ComponentPoolCollectionIds1(ComponentPool<T1>* p1)
+        using value_type = std::conditional_t<WithIds, std::tuple<Entity, Ts&...>, std::tuple<Ts&...>>;
+        using Slots = std::array<uint32_t, sizeof...(Ts)>;
+
+        ComponentView(ComponentPool<Ts>*... pools)
+            : m_pools(pools...)
         {
-            m_p1 = p1;
+            size_t sizes[] = { pools->size()... };
+            const ComponentStorage<Entity>* entities[] = { &pools->entities()... };
+
+            m_driver = 0;
+            for (size_t i = 1; i < sizeof...(Ts); i++)
+            {
+                if (sizes[i] < sizes[m_driver])
+                    m_driver = i;
+            }
+            m_entities = entities[m_driver];
         }
 
         class Iterator
         {
         public:
-            using value_type = std::pair<Entity, T1&>;
-
-            Iterator(ComponentPool<T1>* p1, size_t i)
+            Iterator(const ComponentView* view, size_t i)
             {
-                m_p1 = p1;
+                m_view = view;
                 m_i = i;
+                skip_missing();
             }
 
-            value_type operator*()
+            value_type operator*() const
             {
-                return { m_p1->entity_at(m_i), m_p1->component_at(m_i) };
+                return m_view->get((*m_view->m_entities)[m_i], m_slots);
             }
 
             Iterator& operator++()
             {
-                if (m_i < m_p1->size())
-                    m_i++;
+                m_i++;
+                skip_missing();
                 return *this;
             }
 
-            bool operator==(const Iterator& b)
+            bool operator==(const Iterator& b) const
             {
-                return m_p1 == b.m_p1
-                    && m_i == b.m_i;
+                return m_view == b.m_view && m_i == b.m_i;
             }
 
-            bool operator!=(const Iterator& b)
+            bool operator!=(const Iterator& b) const
             {
                 return !(*this == b);
             }
 
         private:
-            ComponentPool<T1>* m_p1;
+            void skip_missing()
+            {
+                while (m_i < m_view->m_entities->size() && !m_view->find_slots(m_i, m_slots))
+                    m_i++;
+            }
+
+            const ComponentView* m_view;
             size_t m_i;
+            Slots m_slots;
         };
 
-        Iterator begin() { return Iterator(m_p1, 0); }
-        Iterator end() { return Iterator(m_p1, m_p1->size()); }
+        Iterator begin() const { return Iterator(this, 0); }
+        Iterator end() const { return Iterator(this, m_entities->size()); }
+
+        bool contains(Entity entity) const
+        {
+            if (m_filtered && !m_filter.matches(entity))
+                return false;
+            return ((std::get<ComponentPool<Ts>*>(m_pools)->index_of(entity) != ecs::INVALID_INDEX) && ...);
+        }
+
+        // entiteta mora imeti tudi vse komponente Us...
+        template<typename... Us>
+        ComponentView with() const
+        {
+            ComponentView view = *this;
+            (view.m_filter.require(ecs::component_id<Us>()), ...);
+            view.m_filtered = true;
+            return view;
+        }
+
+        // entiteta ne sme imeti nobene od komponent Us...
+        template<typename... Us>
+        ComponentView without() const
+        {
+            ComponentView view = *this;
+            (view.m_filter.exclude(ecs::component_id<Us>()), ...);
+            view.m_filtered = true;
+            return view;
+        }
+
+        // entiteta mora imeti vsaj eno od komponent Us...
+        template<typename... Us>
+        ComponentView any_of() const
+        {
+            ComponentView view = *this;
+            view.m_filter.require_any({ ecs::component_id<Us>()... });
+            view.m_filtered = true;
+            return view;
+        }
+
+        // func(Ts&...) ali func(Entity, Ts&...) ce je WithIds
+        // hitrejse od range for zanke ker ne gradi tuplov
+        template<typename Func>
+        void each(Func&& func) const
+        {
+            each_range(func, 0, m_entities->size());
+        }
+
+        // kot each, samo da se chunki izvedejo na worker threadih
+        // func mora biti varen za hkratno izvajanje, strukturne spremembe niso dovoljene
+        template<typename Func>
+        void parallel_each(Func&& func, size_t min_chunk_size = 64) const
+        {
+            ecs::parallel_for_chunks(m_entities->size(), min_chunk_size, [&](size_t begin, size_t end) {
+                each_range(func, begin, end);
+            });
+        }
+
+        // kot each, samo za entitete pri katerih se je vsaj ena od komponent spremenila na ali po ticku
+        template<typename Func>
+        void each_changed_since(uint32_t tick, Func&& func) const
+        {
+            const ComponentStorage<Entity>& entities = *m_entities;
+            Slots slots;
+            for (size_t i = 0; i < entities.size(); i++)
+            {
+                if (find_slots(i, slots) && changed_since(slots, tick, std::index_sequence_for<Ts...>{}))
+                    call(func, entities[i], slots, std::index_sequence_for<Ts...>{});
+            }
+        }
 
     private:
-        ComponentPool<T1>* m_p1;
+        template<size_t... Is>
+        bool changed_since(const Slots& slots, uint32_t tick, std::index_sequence<Is...>) const
+        {
+            return ((std::get<Is>(m_pools)->version_at(slots[Is]) >= tick) || ...);
+        }
+
+        template<typename Func>
+        void each_range(Func& func, size_t begin, size_t end) const
+        {
+            Slots slots;
+            size_t i = begin;
+            while (i < end)
+            {
+                // entitete driver poola gredo po blokih
+                size_t block = i >> ecs::COMPONENT_BLOCK_SHIFT;
+                size_t block_start = block << ecs::COMPONENT_BLOCK_SHIFT;
+                size_t block_end = std::min(end, block_start + ecs::COMPONENT_BLOCK_SIZE);
+                const Entity* entities = m_entities->block(block);
+
+                for (; i < block_end; i++)
+                {
+                    Entity entity = entities[i - block_start];
+                    if (find_slots(i, entity, slots, std::index_sequence_for<Ts...>{}))
+                        call(func, entity, slots, std::index_sequence_for<Ts...>{});
+                }
+            }
+        }
+
+        // za entiteto na mestu i v driver poolu poisce indekse v vseh poolih
+        bool find_slots(size_t i, Slots& slots) const
+        {
+            return find_slots(i, (*m_entities)[i], slots, std::index_sequence_for<Ts...>{});
+        }
+
+        template<size_t... Is>
+        bool find_slots(size_t i, Entity entity, Slots& slots, std::index_sequence<Is...>) const
+        {
+            if (m_filtered && !m_filter.matches(entity))
+                return false;
+            return ((slots[Is] = (Is == m_driver) ? (uint32_t)i : std::get<Is>(m_pools)->sparse_index(entity), slots[Is] != ecs::INVALID_INDEX) && ...);
+        }
+
+        value_type get(Entity entity, const Slots& slots) const
+        {
+            return get(entity, slots, std::index_sequence_for<Ts...>{});
+        }
+
+        template<size_t... Is>
+        value_type get(Entity entity, const Slots& slots, std::index_sequence<Is...>) const
+        {
+            if constexpr (WithIds)
+                return value_type(entity, std::get<Is>(m_pools)->component_at(slots[Is])...);
+            else
+                return value_type(std::get<Is>(m_pools)->component_at(slots[Is])...);
+        }
+
+        template<typename Func, size_t... Is>
+        void call(Func& func, Entity entity, const Slots& slots, std::index_sequence<Is...>) const
+        {
+            if constexpr (WithIds)
+                func(entity, std::get<Is>(m_pools)->component_at(slots[Is])...);
+            else
+                func(std::get<Is>(m_pools)->component_at(slots[Is])...);
+        }
+
+        std::tuple<ComponentPool<Ts>*...> m_pools;
+        const ComponentStorage<Entity>* m_entities;
+        size_t m_driver;
+        ecs::Filter m_filter;
+        bool m_filtered = false;
     };
 
-    template<typename T1, typename T2>
-    class ComponentPoolCollection2
+    // linearen sprehod cez grupo, brez iskanja po ostalih poolih
+    template<bool WithIds, typename... Ts>
+    class GroupView
     {
     public:
-        ComponentPoolCollection2(ComponentPool<T1>* p1, ComponentPool<T2>* p2)
+        using value_type = std::conditional_t<WithIds, std::tuple<Entity, Ts&...>, std::tuple<Ts&...>>;
+
+        GroupView(const ecs::Group* group, ComponentPool<Ts>*... pools)
+            : m_pools(pools...)
         {
-            m_p1 = p1;
-            m_p2 = p2;
+            m_group = group;
         }
 
         class Iterator
         {
         public:
-            using value_type = std::pair<T1&, T2&>;
-
-            Iterator(ComponentPool<T1>* p1, ComponentPool<T2>* p2, size_t i)
+            Iterator(const GroupView* view, size_t i)
             {
-                m_p1 = p1;
-                m_p2 = p2;
+                m_view = view;
                 m_i = i;
+            }
+
+            value_type operator*() const
+            {
+                return m_view->get(m_i, std::index_sequence_for<Ts...>{});
+            }
+
+            Iterator& operator++()
+            {
+                m_i++;
+                return *this;
+            }
+
+            bool operator==(const Iterator& b) const
+            {
+                return m_view == b.m_view && m_i == b.m_i;
+            }
+
+            bool operator!=(const Iterator& b) const
+            {
+                return !(*this == b);
+            }
+
+        private:
+            const GroupView* m_view;
+            size_t m_i;
+        };
+
+        Iterator begin() const { return Iterator(this, 0); }
+        Iterator end() const { return Iterator(this, m_group->size); }
+        size_t size() const { return m_group->size; }
+
+        // func(Ts&...) ali func(Entity, Ts&...) ce je WithIds
+        template<typename Func>
+        void each(Func&& func) const
+        {
+            each_range(func, 0, m_group->size, std::index_sequence_for<Ts...>{});
+        }
+
+        // kot each, samo da se chunki izvedejo na worker threadih
+        // func mora biti varen za hkratno izvajanje, strukturne spremembe niso dovoljene
+        template<typename Func>
+        void parallel_each(Func&& func, size_t min_chunk_size = 64) const
+        {
+            ecs::parallel_for_chunks(m_group->size, min_chunk_size, [&](size_t begin, size_t end) {
+                each_range(func, begin, end, std::index_sequence_for<Ts...>{});
+            });
+        }
+
+    private:
+        template<size_t... Is>
+        value_type get(size_t i, std::index_sequence<Is...>) const
+        {
+            if constexpr (WithIds)
+                return value_type(std::get<0>(m_pools)->entity_at(i), std::get<Is>(m_pools)->component_at(i)...);
+            else
+                return value_type(std::get<Is>(m_pools)->component_at(i)...);
+        }
+
+        // bloki vseh poolov se zacnejo na istih indeksih, zato je znotraj bloka vse zaporedno
+        template<typename Func, size_t... Is>
+        void each_range(Func& func, size_t begin, size_t end, std::index_sequence<Is...>) const
+        {
+            const ComponentStorage<Entity>& entity_storage = std::get<0>(m_pools)->entities();
+            size_t i = begin;
+            while (i < end)
+            {
+                size_t block = i >> ecs::COMPONENT_BLOCK_SHIFT;
+                size_t block_start = block << ecs::COMPONENT_BLOCK_SHIFT;
+                size_t block_end = std::min(end, block_start + ecs::COMPONENT_BLOCK_SIZE);
+                const Entity* entities = entity_storage.block(block);
+                std::tuple<Ts*...> components(std::get<Is>(m_pools)->block(block)...);
+
+                for (; i < block_end; i++)
+                {
+                    if constexpr (WithIds)
+                        func(entities[i - block_start], std::get<Is>(components)[i - block_start]...);
+                    else
+                        func(std::get<Is>(components)[i - block_start]...);
+                }
+            }
+        }
+
+        std::tuple<ComponentPool<Ts>*...> m_pools;
+        const ecs::Group* m_group;
+    };
+
+    namespace ecs
+    {
+        // gosta tabela vseh entitet, indeksirana z entity_index
+        // signature so v enem ravnem nizu, vsaka entiteta ima signature_words 64 bitnih besed
+        struct EntityTable
+        {
+            std::vector<uint32_t> generations;
+            std::vector<uint32_t> free_indices;
+            std::vector<uint64_t> signatures;
+            uint32_t signature_words = 1;
+        };
+
+        std::vector<IComponentPool*>& component_pools();
+        EntityTable& entity_table();
+        std::vector<Group*>& groups();
+
+        struct Stats
+        {
+            std::vector<PoolStats> pools;
+
+            size_t entities_alive;
+            size_t entity_table_size; // vkljucno z unicenimi indeksi, ki cakajo na ponovno uporabo
+            size_t entity_table_bytes; // generacije in free list
+            size_t signature_bytes;
+            uint32_t signature_words;
+
+            uint32_t structural_changes; // v prejsnjem framu
+
+            size_t total_bytes() const;
+        };
+
+        // sestavi statistiko za vse poole, ni namenjeno za vsak frame v hot pathu
+        Stats stats();
+
+        inline int lowest_set_bit(uint64_t bits)
+        {
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward64(&index, bits);
+            return (int)index;
+#else
+            return __builtin_ctzll(bits);
+#endif
+        }
+
+        inline bool is_alive(Entity entity)
+        {
+            const EntityTable& table = entity_table();
+            uint32_t index = entity_index(entity);
+            return index < table.generations.size() && table.generations[index] == entity_generation(entity);
+        }
+
+        inline uint64_t* signature(Entity entity)
+        {
+            EntityTable& table = entity_table();
+            return &table.signatures[(size_t)entity_index(entity) * table.signature_words];
+        }
+
+        inline bool has_signature_bit(Entity entity, uint32_t comp_id)
+        {
+            if (comp_id >= entity_table().signature_words * 64)
+                return false;
+            return (signature(entity)[comp_id / 64] >> (comp_id % 64)) & 1;
+        }
+
+        inline bool Filter::matches(Entity entity) const
+        {
+            uint32_t words = m_table->signature_words;
+            const uint64_t* sig = &m_table->signatures[(size_t)entity_index(entity) * words];
+
+            // besede izven signature so 0, ker teh komponent se ni imela nobena entiteta
+            for (size_t w = 0; w < m_with.size(); w++)
+            {
+                uint64_t word = w < words ? sig[w] : 0;
+                if ((word & m_with[w]) != m_with[w])
+                    return false;
+            }
+
+            for (size_t w = 0; w < m_without.size() && w < words; w++)
+            {
+                if ((sig[w] & m_without[w]) != 0)
+                    return false;
+            }
+
+            for (const std::vector<uint64_t>& any_of : m_any_of)
+            {
+                bool found = false;
+                for (size_t w = 0; w < any_of.size() && w < words && !found; w++)
+                    found = (sig[w] & any_of[w]) != 0;
+                if (!found)
+                    return false;
+            }
+
+            return true;
+        }
+
+        // registrirana poizvedba: seznam entitet, ki ustrezajo filtru, se posodobi ob vsaki spremembi
+        // signature, zato iteracija ne preverja vseh entitet posameznih poolov
+        struct Query
+        {
+            Filter filter;
+            std::vector<Entity> entities;
+            std::vector<uint32_t> positions; // entity_index -> index v entities
+        };
+
+        // za vsak comp_id poizvedbe, na katere vpliva ta komponenta
+        std::vector<std::vector<Query*>>& query_index();
+
+        // vsaka specializacija QueryView ima svoj slot, poizvedba v slotu je za vsak svet svoja
+        static constexpr uint32_t MAX_QUERIES = 256;
+        uint32_t new_query_slot();
+        // nullptr, dokler poizvedba v tem svetu ni registrirana
+        Query* find_query(uint32_t slot);
+        // doda vse obstojece entitete, ki ustrezajo, lahko se klice tudi iz sistemov
+        Query* register_query(uint32_t slot, const std::vector<uint32_t>& required, const std::vector<uint32_t>& excluded);
+        void update_query(Query& query, Entity entity);
+        // po restore
+        void rebuild_queries();
+
+        inline void update_queries(Entity entity, uint32_t comp_id)
+        {
+            std::vector<std::vector<Query*>>& index = query_index();
+            if (comp_id >= index.size())
+                return;
+            for (Query* query : index[comp_id])
+                update_query(*query, entity);
+        }
+
+        // vec kot 64 * signature_words komponent, razsiri vse signature
+        inline void grow_signatures(uint32_t new_words)
+        {
+            EntityTable& table = entity_table();
+            if (new_words <= table.signature_words)
+                return;
+
+            size_t count = table.generations.size();
+            std::vector<uint64_t> signatures(count * new_words, 0);
+            for (size_t i = 0; i < count; i++)
+            {
+                for (uint32_t w = 0; w < table.signature_words; w++)
+                    signatures[i * new_words + w] = table.signatures[i * table.signature_words + w];
+            }
+            table.signatures = std::move(signatures);
+            table.signature_words = new_words;
+        }
+
+        inline void set_signature_bit(Entity entity, uint32_t comp_id, bool value)
+        {
+            grow_signatures(comp_id / 64 + 1);
+
+            uint64_t& word = signature(entity)[comp_id / 64];
+            if (value)
+                word |= (uint64_t)1 << (comp_id % 64);
+            else
+                word &= ~((uint64_t)1 << (comp_id % 64));
+
+            update_queries(entity, comp_id);
+        }
+
+        inline bool matches_group(const Group& group, Entity entity)
+        {
+            for (uint32_t comp_id : group.comp_ids)
+            {
+                if (!has_signature_bit(entity, comp_id))
+                    return false;
+            }
+            return true;
+        }
+
+        inline bool in_group(const Group& group, Entity entity)
+        {
+            return component_pools()[group.comp_ids[0]]->sparse_index(entity) < group.size;
+        }
+
+        // premakne entiteto na konec grupe v vseh poolih grupe
+        inline void enter_group(Group& group, Entity entity)
+        {
+            for (uint32_t comp_id : group.comp_ids)
+            {
+                IComponentPool* pool = component_pools()[comp_id];
+                pool->swap_slots(pool->sparse_index(entity), group.size);
+            }
+            group.size++;
+        }
+
+        inline void leave_group(Group& group, Entity entity)
+        {
+            group.size--;
+            for (uint32_t comp_id : group.comp_ids)
+            {
+                IComponentPool* pool = component_pools()[comp_id];
+                pool->swap_slots(pool->sparse_index(entity), group.size);
+            }
+        }
+
+        inline Entity create_entity()
+        {
+            ASSERT(structural_changes_allowed());
+            structural_changes()++;
+            EntityTable& table = entity_table();
+
+            uint32_t index;
+            if (table.free_indices.size() > 0)
+            {
+                index = table.free_indices.back();
+                table.free_indices.pop_back();
+            }
+            else
+            {
+                index = table.generations.size();
+                ASSERT(index < ENTITY_INDEX_MASK); // ENTITY_INDEX_MASK je rezerviran za NULL_ENTITY
+                table.generations.push_back(0);
+                table.signatures.resize(table.signatures.size() + table.signature_words, 0);
+            }
+
+            return make_entity(index, table.generations[index]);
+        }
+
+        // stare entitete (ze unicene) so ignorirane
+        inline void destroy_entity(Entity entity)
+        {
+            ASSERT(structural_changes_allowed());
+            if (!is_alive(entity))
+                return;
+            structural_changes()++;
+
+            EntityTable& table = entity_table();
+            uint64_t* sig = signature(entity);
+
+            for (uint32_t w = 0; w < table.signature_words; w++)
+            {
+                uint64_t bits = sig[w];
+                sig[w] = 0;
+                while (bits != 0)
+                {
+                    uint32_t comp_id = w * 64 + lowest_set_bit(bits);
+                    bits &= bits - 1;
+                    update_queries(entity, comp_id);
+
+                    // tagi nimajo poola
+                    IComponentPool* pool = comp_id < component_pools().size() ? component_pools()[comp_id] : nullptr;
+                    if (pool == nullptr)
+                        continue;
+
+                    if (pool->group() != nullptr && in_group(*pool->group(), entity))
+                        leave_group(*pool->group(), entity);
+                    pool->remove_component(entity);
+                }
+            }
+
+            uint32_t index = entity_index(entity);
+            // ENTITY_GENERATION_MASK je rezerviran za placeholderje
+            table.generations[index] = (table.generations[index] + 1) % ENTITY_GENERATION_MASK;
+            table.free_indices.push_back(index);
+        }
+
+        template<typename T>
+        inline ComponentPool<T>* get_pool()
+        {
+            static_assert(!is_tag_v<T>, "tag komponente nimajo poola, uporabi with/without/any_of");
+            uint32_t comp_id = component_id<T>();
+            if (comp_id >= component_pools().size())
+                component_pools().resize(comp_id + 1, nullptr);
+
+            if (component_pools()[comp_id] == nullptr)
+                component_pools()[comp_id] = new ComponentPool<T>();
+
+            return (ComponentPool<T>*)(component_pools()[comp_id]);
+        }
+
+        template<typename T>
+        inline T& get_component(Entity entity)
+        {
+            return get_pool<T>()->get_component(entity);
+        }
+
+        template<typename T>
+        inline bool has_component(Entity entity)
+        {
+            return has_signature_bit(entity, component_id<T>());
+        }
 
-                while (m_i < m_p1->size() && m_p2->try_get_component(m_p1->entity_at(m_i)) == nullptr)
-                {
-                    m_i++;
-                }
-            }
+        template<typename T>
+        inline void add_component(T comp, Entity entity)
+        {
+            ASSERT(structural_changes_allowed());
+            ASSERT(is_alive(entity));
+            structural_changes()++;
 
-            value_type operator*()
+            if constexpr (is_tag_v<T>)
             {
-                Entity e = m_p1->entity_at(m_i);
-                return { m_p1->component_at(m_i), m_p2->get_component(e) };
+                ASSERT(!has_component<T>(entity));
+                set_signature_bit(entity, component_id<T>(), true);
             }
-
-            Iterator& operator++()
+            else
             {
-                T2* t;
-                do {
-                    m_i++;
-                    if (m_i == m_p1->size())
-                        return *this;
-                    Entity e = m_p1->entity_at(m_i);
-                    t = m_p2->try_get_component(e);
-                } while (t == nullptr);
+                ComponentPool<T>* pool = get_pool<T>();
+                pool->add_component(std::move(comp), entity);
+                set_signature_bit(entity, component_id<T>(), true);
 
-                return *this;
+                if (pool->group() != nullptr && matches_group(*pool->group(), entity))
+                    enter_group(*pool->group(), entity);
+
+                if (!pool->on_construct().empty())
+                    pool->on_construct().emit(entity, pool->get_component(entity));
             }
+        }
+
+        template<typename T>
+        inline void remove_component(Entity entity)
+        {
+            ASSERT(structural_changes_allowed());
+            ASSERT(is_alive(entity));
+            structural_changes()++;
 
-            bool operator==(const Iterator& b)
+            if constexpr (is_tag_v<T>)
             {
-                return m_p1 == b.m_p1
-                    && m_p2 == b.m_p2
-                    && m_i == b.m_i;
+                ASSERT(has_component<T>(entity));
+                set_signature_bit(entity, component_id<T>(), false);
             }
-
-            bool operator!=(const Iterator& b)
+            else
             {
-                return !(*this == b);
+                ComponentPool<T>* pool = get_pool<T>();
+                if (pool->group() != nullptr && in_group(*pool->group(), entity))
+                    leave_group(*pool->group(), entity);
+
+                pool->remove_component(entity);
+                set_signature_bit(entity, component_id<T>(), false);
             }
+        }
 
-        private:
-            ComponentPool<T1>* m_p1;
-            ComponentPool<T2>* m_p2;
-            size_t m_i;
-        };
+        // oznaci komponento kot spremenjeno v trenutnem ticku
+        // lahko se klice iz parallel_each, ce vsak chunk oznacuje samo svoje entitete
+        template<typename T>
+        inline void mark_changed(Entity entity)
+        {
+            get_pool<T>()->mark_changed(entity);
+        }
 
-        Iterator begin() { return Iterator(m_p1, m_p2, 0); }
-        Iterator end() { return Iterator(m_p1, m_p2, m_p1->size()); }
+        // observerji za inkrementalno vzdrzevanje indeksov (npr. spatial hash), tagi jih nimajo
+        // veljajo za pool v trenutnem svetu, tudi za spremembe iz CommandBuffer in instantiate
+        template<typename T>
+        inline Signal<T>& on_construct()
+        {
+            return get_pool<T>()->on_construct();
+        }
 
-    private:
-        ComponentPool<T1>* m_p1;
-        ComponentPool<T2>* m_p2;
-    };
+        template<typename T>
+        inline Signal<T>& on_destroy()
+        {
+            return get_pool<T>()->on_destroy();
+        }
 
-    template<typename T1, typename T2>
-    class ComponentPoolCollectionIds2
-    {
-    public:
-        ComponentPoolCollectionIds2(ComponentPool<T1>* p1, ComponentPool<T2>* p2)
+        template<typename T>
+        inline Signal<T>& on_update()
         {
-            m_p1 = p1;
-            m_p2 = p2;
+            return get_pool<T>()->on_update();
         }
 
-        class Iterator
+        template<typename T>
+        inline ComponentPool<T>& get_components()
         {
-        public:
-            using value_type = std::tuple<Entity, T1&, T2&>;
+            return *get_pool<T>();
+        }
 
-            Iterator(ComponentPool<T1>* p1, ComponentPool<T2>* p2, size_t i)
-            {
-                m_p1 = p1;
-                m_p2 = p2;
-                m_i = i;
+        template<typename... Ts>
+        inline ComponentView<false, Ts...> view()
+        {
+            return ComponentView<false, Ts...>(get_pool<Ts>()...);
+        }
 
-                while (m_i < m_p1->size() && m_p2->try_get_component(m_p1->entity_at(m_i)) == nullptr)
-                {
-                    m_i++;
-                }
-            }
+        template<typename... Ts>
+        inline ComponentView<true, Ts...> view_ids()
+        {
+            return ComponentView<true, Ts...>(get_pool<Ts>()...);
+        }
 
-            value_type operator*()
+        // keys so (kljuc, entiteta) za slote [begin, begin + keys.size()), entitete se premaknejo po vrsti kljucev
+        // vsi pooli morajo imeti te entitete v istih slotih (npr. pooli iste grupe)
+        inline void reorder_slots(const std::vector<IComponentPool*>& pools, size_t begin, std::vector<std::pair<uint64_t, Entity>>& keys)
+        {
+            std::sort(keys.begin(), keys.end());
+            for (size_t i = 0; i < keys.size(); i++)
             {
-                Entity e = m_p1->entity_at(m_i);
-                return { e, m_p1->component_at(m_i), m_p2->get_component(e) };
+                uint32_t slot = pools[0]->sparse_index(keys[i].second);
+                for (IComponentPool* pool : pools)
+                    pool->swap_slots((uint32_t)(begin + i), slot);
             }
+        }
 
-            Iterator& operator++()
-            {
-                T2* t;
-                do {
-                    m_i++;
-                    if (m_i == m_p1->size())
-                        return *this;
-                    Entity e = m_p1->entity_at(m_i);
-                    t = m_p2->try_get_component(e);
-                } while (t == nullptr);
-
-                return *this;
-            }
+        // uredi pool po key(Entity, T&) -> uint64_t, npr. Morton kodi pozicije, da so entitete,
+        // ki so blizu v prostoru, blizu tudi v pomnilniku; poizvedbe in grupe ostanejo veljavne
+        // ce je pool v grupi, se entitete grupe enako uredijo v vseh poolih grupe in ostanejo na zacetku
+        template<typename T, typename Key>
+        inline void sort_pool(Key&& key)
+        {
+            ASSERT(structural_changes_allowed());
+            ComponentPool<T>* pool = get_pool<T>();
 
-            bool operator==(const Iterator& b)
+            size_t group_size = 0;
+            std::vector<std::pair<uint64_t, Entity>> keys;
+            if (Group* group = pool->group())
             {
-                return m_p1 == b.m_p1
-                    && m_p2 == b.m_p2
-                    && m_i == b.m_i;
+                group_size = group->size;
+                std::vector<IComponentPool*> group_pools;
+                for (uint32_t comp_id : group->comp_ids)
+                    group_pools.push_back(component_pools()[comp_id]);
+
+                for (size_t i = 0; i < group_size; i++)
+                    keys.push_back({ (uint64_t)key(pool->entity_at(i), pool->component_at(i)), pool->entity_at(i) });
+                reorder_slots(group_pools, 0, keys);
             }
 
-            bool operator!=(const Iterator& b)
-            {
-                return !(*this == b);
-            }
+            keys.clear();
+            for (size_t i = group_size; i < pool->size(); i++)
+                keys.push_back({ (uint64_t)key(pool->entity_at(i), pool->component_at(i)), pool->entity_at(i) });
+            reorder_slots({ pool }, group_size, keys);
+        }
 
-        private:
-            ComponentPool<T1>* m_p1;
-            ComponentPool<T2>* m_p2;
-            size_t m_i;
-        };
+        // func(Ts&...) se izvede za vse entitete s komponentami Ts... na vec threadih
+        template<typename... Ts, typename Func>
+        inline void parallel_each(Func&& func)
+        {
+            view<Ts...>().parallel_each(func);
+        }
 
-        Iterator begin() { return Iterator(m_p1, m_p2, 0); }
-        Iterator end() { return Iterator(m_p1, m_p2, m_p1->size()); }
+        // func(Entity, Ts&...)
+        template<typename... Ts, typename Func>
+        inline void parallel_each_ids(Func&& func)
+        {
+            view_ids<Ts...>().parallel_each(func);
+        }
 
-    private:
-        ComponentPool<T1>* m_p1;
-        ComponentPool<T2>* m_p2;
-    };
+        template<typename T1, typename T2, typename... Ts>
+        inline ComponentView<false, T1, T2, Ts...> get_components()
+        {
+            return view<T1, T2, Ts...>();
+        }
 
-    template<typename T1, typename T2, typename T3>
-    class ComponentPoolCollection3
-    {
-    public:
-        ComponentPoolCollection3(ComponentPool<T1>* p1, ComponentPool<T2>* p2, ComponentPool<T3>* p3)
+        template<typename... Ts>
+        inline ComponentView<true, Ts...> get_components_ids()
         {
-            m_p1 = p1;
-            m_p2 = p2;
-            m_p3 = p3;
+            return view_ids<Ts...>();
         }
 
-        class Iterator
+        // zlozi entitete grupe na zacetek poolov, npr. ko je grupa nova ali po restore
+        inline void rebuild_group(Group& group)
         {
-        public:
-            using value_type = std::tuple<T1&, T2&, T3&>;
+            group.size = 0;
 
-            Iterator(ComponentPool<T1>* p1, ComponentPool<T2>* p2, ComponentPool<T3>* p3, size_t i)
+            uint32_t smallest = group.comp_ids[0];
+            for (uint32_t comp_id : group.comp_ids)
             {
-                m_p1 = p1;
-                m_p2 = p2;
-                m_p3 = p3;
-                m_i = i;
-
-                while (m_i < m_p1->size() && (
-                    m_p2->try_get_component(m_p1->entity_at(m_i)) == nullptr ||
-                    m_p3->try_get_component(m_p1->entity_at(m_i)) == nullptr))
-                {
-                    m_i++;
-                }
+                if (component_pools()[comp_id]->size() < component_pools()[smallest]->size())
+                    smallest = comp_id;
             }
 
-            value_type operator*()
-            {
-                Entity e = m_p1->entity_at(m_i);
-                return { m_p1->component_at(m_i), m_p2->get_component(e), m_p3->get_component(e) };
-            }
+            std::vector<Entity> entities;
+            IComponentPool* pool = component_pools()[smallest];
+            for (size_t i = 0; i < pool->size(); i++)
+                entities.push_back(pool->entity_at(i));
 
-            Iterator& operator++()
+            for (Entity entity : entities)
             {
-                Entity e;
-                do {
-                    m_i++;
-                    if (m_i == m_p1->size())
-                        return *this;
-                    e = m_p1->entity_at(m_i);
-                } while (m_p2->try_get_component(e) == nullptr || m_p3->try_get_component(e) == nullptr);
-
-                return *this;
+                if (matches_group(group, entity))
+                    enter_group(group, entity);
             }
+        }
 
-            bool operator==(const Iterator& b)
+        // poisce ali ustvari grupo, ki si lasti poole s temi komponentami
+        // en pool je lahko samo v eni grupi
+        inline Group* get_group(std::vector<uint32_t> comp_ids)
+        {
+            std::sort(comp_ids.begin(), comp_ids.end());
+            for (Group* group : groups())
             {
-                return m_p1 == b.m_p1
-                    && m_p2 == b.m_p2
-                    && m_p3 == b.m_p3
-                    && m_i == b.m_i;
+                if (group->comp_ids == comp_ids)
+                    return group;
             }
 
-            bool operator!=(const Iterator& b)
+            Group* group = new Group();
+            group->comp_ids = comp_ids;
+            groups().push_back(group);
+
+            for (uint32_t comp_id : comp_ids)
             {
-                return !(*this == b);
+                ASSERT(component_pools()[comp_id]->group() == nullptr);
+                component_pools()[comp_id]->set_group(group);
             }
 
-        private:
-            ComponentPool<T1>* m_p1;
-            ComponentPool<T2>* m_p2;
-            ComponentPool<T3>* m_p3;
-            size_t m_i;
-        };
+            rebuild_group(*group);
+            return group;
+        }
 
-        Iterator begin() { return Iterator(m_p1, m_p2, m_p3, 0); }
-        Iterator end() { return Iterator(m_p1, m_p2, m_p3, m_p1->size()); }
+        // entitete z vsemi komponentami Ts... so v poolih zlozene skupaj,
+        // zato je iteracija cez grupo linearna, dodajanje in odstranjevanje pa malo drazje
+        template<typename... Ts>
+        inline GroupView<false, Ts...> group()
+        {
+            Group* group = get_group({ (get_pool<Ts>(), component_id<Ts>())... });
+            return GroupView<false, Ts...>(group, get_pool<Ts>()...);
+        }
 
-    private:
-        ComponentPool<T1>* m_p1;
-        ComponentPool<T2>* m_p2;
-        ComponentPool<T3>* m_p3;
-    };
+        template<typename... Ts>
+        inline GroupView<true, Ts...> group_ids()
+        {
+            Group* group = get_group({ (get_pool<Ts>(), component_id<Ts>())... });
+            return GroupView<true, Ts...>(group, get_pool<Ts>()...);
+        }
+
+        template<typename... Ts>
+        struct TypeList {};
+
+        template<typename A, typename B>
+        struct ConcatTypeList;
+
+        template<typename... As, typename... Bs>
+        struct ConcatTypeList<TypeList<As...>, TypeList<Bs...>>
+        {
+            using type = TypeList<As..., Bs...>;
+        };
 
-    template<typename T1, typename T2, typename T3>
-    class ComponentPoolCollectionIds3
+        template<typename... Ts>
+        inline std::vector<uint32_t> component_ids(TypeList<Ts...>)
+        {
+            return { component_id<Ts>()... };
+        }
+    }
+
+    // iteracija cez registrirano poizvedbo, samo sprehod po seznamu entitet, ki ustrezajo
+    // With in Without sta TypeList komponent (lahko tagov), ki jih entiteta mora oz. ne sme imeti
+    template<bool WithIds, typename With, typename Without, typename... Ts>
+    class QueryView
     {
     public:
-        ComponentPoolCollectionIds3(ComponentPool<T1>* p1, ComponentPool<T2>* p2, ComponentPool<T3>* p3)
+        using value_type = std::conditional_t<WithIds, std::tuple<Entity, Ts&...>, std::tuple<Ts&...>>;
+
+        QueryView()
+            : m_pools(ecs::get_pool<Ts>()...)
         {
-            m_p1 = p1;
-            m_p2 = p2;
-            m_p3 = p3;
+            m_entities = &query().entities;
         }
 
         class Iterator
         {
         public:
-            using value_type = std::tuple<Entity, T1&, T2&, T3&>;
-
-            Iterator(ComponentPool<T1>* p1, ComponentPool<T2>* p2, ComponentPool<T3>* p3, size_t i)
+            Iterator(const QueryView* view, size_t i)
             {
-                m_p1 = p1;
-                m_p2 = p2;
-                m_p3 = p3;
+                m_view = view;
                 m_i = i;
-
-                while (m_i < m_p1->size() && (
-                    m_p2->try_get_component(m_p1->entity_at(m_i)) == nullptr ||
-                    m_p3->try_get_component(m_p1->entity_at(m_i)) == nullptr))
-                {
-                    m_i++;
-                }
             }
 
-            value_type operator*()
-            {
-                Entity e = m_p1->entity_at(m_i);
-                return { e, m_p1->component_at(m_i), m_p2->get_component(e), m_p3->get_component(e) };
-            }
+            value_type operator*() const { return m_view->get((*m_view->m_entities)[m_i]); }
 
             Iterator& operator++()
             {
-                Entity e;
-                do {
-                    m_i++;
-                    if (m_i == m_p1->size())
-                        return *this;
-                    e = m_p1->entity_at(m_i);
-                } while (m_p2->try_get_component(e) == nullptr || m_p3->try_get_component(e) == nullptr);
-
+                m_i++;
                 return *this;
             }
 
-            bool operator==(const Iterator& b)
-            {
-                return m_p1 == b.m_p1
-                    && m_p2 == b.m_p2
-                    && m_p3 == b.m_p3
-                    && m_i == b.m_i;
-            }
-
-            bool operator!=(const Iterator& b)
-            {
-                return !(*this == b);
-            }
+            bool operator==(const Iterator& b) const { return m_view == b.m_view && m_i == b.m_i; }
+            bool operator!=(const Iterator& b) const { return !(*this == b); }
 
         private:
-            ComponentPool<T1>* m_p1;
-            ComponentPool<T2>* m_p2;
-            ComponentPool<T3>* m_p3;
+            const QueryView* m_view;
             size_t m_i;
         };
 
-        Iterator begin() { return Iterator(m_p1, m_p2, m_p3, 0); }
-        Iterator end() { return Iterator(m_p1, m_p2, m_p3, m_p1->size()); }
-
-    private:
-        ComponentPool<T1>* m_p1;
-        ComponentPool<T2>* m_p2;
-        ComponentPool<T3>* m_p3;
-    };
-
-    namespace ecs
-    {
-        std::vector<IComponentPool*>& component_pools();
-        std::unordered_map<Entity, std::bitset<32>>& signatures();
-        std::unordered_set<Entity>& to_destroy();
-
-        inline uint32_t new_component_id()
-        {
-            static uint32_t id = 0;
-            return id++;
-        }
+        Iterator begin() const { return Iterator(this, 0); }
+        Iterator end() const { return Iterator(this, m_entities->size()); }
+        size_t size() const { return m_entities->size(); }
+        bool empty() const { return m_entities->empty(); }
 
-        template<typename T>
-        inline uint32_t component_id()
+        // za poizvedbe z natanko eno entiteto, npr. lokalni igralec
+        value_type single() const
         {
-            static uint32_t comp_id = new_component_id();
-            return comp_id;
+            ASSERT(m_entities->size() == 1);
+            return get((*m_entities)[0]);
         }
 
-        inline Entity create_entity()
+        // func(Ts&...) ali func(Entity, Ts&...) ce je WithIds
+        template<typename Func>
+        void each(Func&& func) const
         {
-            static uint32_t entity_id = 1;
-            return entity_id++;
+            for (Entity entity : *m_entities)
+                call(func, entity, std::index_sequence_for<Ts...>{});
         }
 
-        inline void destroy_entity(Entity entity)
+        template<typename... Us>
+        QueryView<WithIds, typename ecs::ConcatTypeList<With, ecs::TypeList<Us...>>::type, Without, Ts...> with() const
         {
-            auto it = signatures().find(entity);
-            ASSERT(it != signatures().end());
-            std::bitset<32> signature = it->second;
-            signatures().erase(it);
-
-            for (int i = 0; i < 32 && signature.any(); i++)
-            {
-                if (signature[0] == true)
-                {
-                    uint32_t comp_id = i;
-                    auto pool = component_pools()[comp_id];
-                    pool->remove_component(entity);
-                }
-
-                signature >>= 1;
-            }
+            return {};
         }
 
-        inline void queue_destroy_entity(Entity entity)
+        template<typename... Us>
+        QueryView<WithIds, With, typename ecs::ConcatTypeList<Without, ecs::TypeList<Us...>>::type, Ts...> without() const
         {
-            to_destroy().insert(entity);
+            return {};
         }
 
-        inline void destroy_queued_entities()
+    private:
+        // vsaka kombinacija Ts, With in Without ima svojo poizvedbo, registrira se ob prvi uporabi
+        static ecs::Query& query()
         {
-            for (const auto& entity : to_destroy())
+            static uint32_t slot = ecs::new_query_slot();
+            ecs::Query* query = ecs::find_query(slot);
+            if (query == nullptr)
             {
-                destroy_entity(entity);
+                std::vector<uint32_t> required = ecs::component_ids(ecs::TypeList<Ts...>{});
+                std::vector<uint32_t> with = ecs::component_ids(With{});
+                required.insert(required.end(), with.begin(), with.end());
+                query = ecs::register_query(slot, required, ecs::component_ids(Without{}));
             }
-            to_destroy().clear();
+            return *query;
         }
 
-        template<typename T>
-        inline T& get_component(Entity entity)
+        value_type get(Entity entity) const
         {
-            uint32_t comp_id = component_id<T>();
-            ASSERT(comp_id < component_pools().size());
-            auto pool = (ComponentPool<T>*)(component_pools()[comp_id]);
-            return pool->get_component(entity);
+            return get(entity, std::index_sequence_for<Ts...>{});
         }
 
-        template<typename T>
-        inline void add_component(const T& comp, Entity entity)
+        template<size_t... Is>
+        value_type get(Entity entity, std::index_sequence<Is...>) const
         {
-            uint32_t comp_id = component_id<T>();
-            ASSERT(comp_id <= component_pools().size());
-
-            if (comp_id == component_pools().size())
-            {
-                auto pool = new ComponentPool<T>();
-                component_pools().push_back((IComponentPool*)pool);
-                pool->add_component(comp, entity);
-            }
+            if constexpr (WithIds)
+                return value_type(entity, std::get<Is>(m_pools)->component_at(std::get<Is>(m_pools)->sparse_index(entity))...);
             else
-            {
-                auto pool = (ComponentPool<T>*)(component_pools()[comp_id]);
-                pool->add_component(comp, entity);
-            }
-
-            signatures()[entity][comp_id] = true;
+                return value_type(std::get<Is>(m_pools)->component_at(std::get<Is>(m_pools)->sparse_index(entity))...);
         }
 
-        template<typename T>
-        inline void remove_component(Entity entity)
+        template<typename Func, size_t... Is>
+        void call(Func& func, Entity entity, std::index_sequence<Is...>) const
         {
-            uint32_t comp_id = component_id<T>();
-            ASSERT(comp_id < component_pools().size());
+            if constexpr (WithIds)
+                func(entity, std::get<Is>(m_pools)->component_at(std::get<Is>(m_pools)->sparse_index(entity))...);
+            else
+                func(std::get<Is>(m_pools)->component_at(std::get<Is>(m_pools)->sparse_index(entity))...);
+        }
 
-            auto pool = (ComponentPool<T>*)(component_pools()[comp_id]);
-            pool->remove_component(entity);
+        std::tuple<ComponentPool<Ts>*...> m_pools;
+        const std::vector<Entity>* m_entities;
+    };
 
-            signatures()[entity][comp_id] = false;
+    namespace ecs
+    {
+        // za poizvedbe, ki se izvedejo veckrat na frame
+        // with/without je treba klicati v isti vrstici, npr. query<Player, Transform>().with<LocalPlayer>()
+        template<typename... Ts>
+        inline QueryView<false, TypeList<>, TypeList<>, Ts...> query()
+        {
+            return {};
         }
 
-        template<typename T>
-        inline ComponentPool<T>& get_components()
+        template<typename... Ts>
+        inline QueryView<true, TypeList<>, TypeList<>, Ts...> query_ids()
         {
-            uint32_t comp_id = component_id<T>();
-
-            ASSERT(comp_id <= component_pools().size());
-            if (comp_id == component_pools().size())
-            {
-                auto pool = new ComponentPool<T>();
-                component_pools().push_back((IComponentPool*)pool);
-            }
-
-            return *(ComponentPool<T>*)(component_pools()[comp_id]);
+            return {};
         }
 
-        template<typename T1, typename T2>
-        inline ComponentPoolCollection2<T1, T2> get_components()
+        template<typename T>
+        inline void remove_all_with()
         {
-            uint32_t comp_id1 = component_id<T1>();
-
-            ASSERT(comp_id1 <= component_pools().size());
-            if (comp_id1 == component_pools().size())
+            std::vector<Entity> to_remove;
+            for (auto [id, comp] : ecs::get_components_ids<T>())
             {
-                auto pool = new ComponentPool<T1>();
-                component_pools().push_back((IComponentPool*)pool);
+                to_remove.push_back(id);
             }
 
-            uint32_t comp_id2 = component_id<T2>();
-
-            ASSERT(comp_id2 <= component_pools().size());
-            if (comp_id2 == component_pools().size())
+            for (auto id : to_remove)
             {
-                auto pool = new ComponentPool<T2>();
-                component_pools().push_back((IComponentPool*)pool);
+                ecs::destroy_entity(id);
             }
-
-            auto p1 = (ComponentPool<T1>*)(component_pools()[comp_id1]);
-            auto p2 = (ComponentPool<T2>*)(component_pools()[comp_id2]);
-            return ComponentPoolCollection2(p1, p2);
         }
 
-        template<typename T1, typename T2, typename T3>
-        inline ComponentPoolCollection3<T1, T2, T3> get_components()
+        // nabor komponent s privzetimi vrednostmi, iz katerega instantiate() ustvari entitete
+        // vse instance dobijo kopije istih vrednosti, razlike se nastavijo v init od instantiate
+        class Prefab
         {
-            uint32_t comp_id1 = component_id<T1>();
-
-            ASSERT(comp_id1 <= component_pools().size());
-            if (comp_id1 == component_pools().size())
+        public:
+            struct Component
             {
-                auto pool = new ComponentPool<T1>();
-                component_pools().push_back((IComponentPool*)pool);
-            }
+                uint32_t comp_id;
+                std::shared_ptr<void> value; // nullptr za tage
+                // doda kopije vrednosti vsem entitetam, pool se poveca samo enkrat
+                void (*add)(const void* value, const Entity* entities, size_t count);
+                // on_construct, ko so entitete ze v signaturah in grupah in je init ze nastavil vrednosti
+                void (*constructed)(const Entity* entities, size_t count);
+            };
+
+            // doda komponento ali zamenja njeno privzeto vrednost
+            template<typename T>
+            Prefab& set(T comp)
+            {
+                uint32_t comp_id = component_id<T>();
+                m_components.erase(std::remove_if(m_components.begin(), m_components.end(),
+                    [&](const Component& c) { return c.comp_id == comp_id; }), m_components.end());
 
-            uint32_t comp_id2 = component_id<T2>();
+                Component component;
+                component.comp_id = comp_id;
+                if constexpr (is_tag_v<T>)
+                {
+                    component.add = nullptr;
+                    component.constructed = nullptr;
+                }
+                else
+                {
+                    component.value = std::make_shared<T>(std::move(comp));
+                    component.add = [](const void* value, const Entity* entities, size_t count) {
+                        ComponentPool<T>* pool = get_pool<T>();
+                        pool->reserve(pool->size() + count);
+                        for (size_t i = 0; i < count; i++)
+                            pool->add_component(*(const T*)value, entities[i]);
+                    };
+                    component.constructed = [](const Entity* entities, size_t count) {
+                        ComponentPool<T>* pool = get_pool<T>();
+                        if (pool->on_construct().empty())
+                            return;
+                        // init je lahko komponento ze odstranil
+                        for (size_t i = 0; i < count; i++)
+                        {
+                            if (T* comp = pool->try_get_component(entities[i]))
+                                pool->on_construct().emit(entities[i], *comp);
+                        }
+                    };
+                }
+                m_components.push_back(std::move(component));
 
-            ASSERT(comp_id2 <= component_pools().size());
-            if (comp_id2 == component_pools().size())
-            {
-                auto pool = new ComponentPool<T2>();
-                component_pools().push_back((IComponentPool*)pool);
+                if (comp_id / 64 >= m_signature.size())
+                    m_signature.resize(comp_id / 64 + 1, 0);
+                m_signature[comp_id / 64] |= (uint64_t)1 << (comp_id % 64);
+                return *this;
             }
 
-            uint32_t comp_id3 = component_id<T3>();
+            const std::vector<Component>& components() const { return m_components; }
+            const std::vector<uint64_t>& signature() const { return m_signature; }
 
-            ASSERT(comp_id3 <= component_pools().size());
-            if (comp_id3 == component_pools().size())
-            {
-                auto pool = new ComponentPool<T3>();
-                component_pools().push_back((IComponentPool*)pool);
-            }
+        private:
+            std::vector<Component> m_components;
+            std::vector<uint64_t> m_signature;
+        };
 
-            auto p1 = (ComponentPool<T1>*)(component_pools()[comp_id1]);
-            auto p2 = (ComponentPool<T2>*)(component_pools()[comp_id2]);
-            auto p3 = (ComponentPool<T3>*)(component_pools()[comp_id3]);
-            return ComponentPoolCollection3(p1, p2, p3);
-        }
+        // ustvari count entitet s komponentami prefaba
+        // vsak pool se poveca enkrat, signature in grupe se nastavijo za vse entitete naenkrat
+        // init(Entity, index) nastavi vrednosti instance, on_construct komponent prefaba se sprozi sele za njim
+        std::vector<Entity> instantiate(const Prefab& prefab, size_t count, const std::function<void(Entity, size_t)>& init);
 
-        template<typename T>
-        inline ComponentPoolCollectionIds1<T> get_components_ids()
+        inline std::vector<Entity> instantiate(const Prefab& prefab, size_t count)
         {
-            uint32_t comp_id = component_id<T>();
-
-            ASSERT(comp_id <= component_pools().size());
-            if (comp_id == component_pools().size())
-            {
-                auto pool = new ComponentPool<T>();
-                component_pools().push_back((IComponentPool*)pool);
-            }
+            return instantiate(prefab, count, nullptr);
+        }
 
-            auto p1 = (ComponentPool<T>*)(component_pools()[comp_id]);
-            return ComponentPoolCollectionIds1(p1);
+        inline Entity instantiate(const Prefab& prefab)
+        {
+            return instantiate(prefab, 1)[0];
         }
 
-        template<typename T1, typename T2>
-        inline ComponentPoolCollectionIds2<T1, T2> get_components_ids()
+        // zapise strukturne spremembe, ki se izvedejo sele ob execute(), zato se lahko uporablja med iteracijo
+        // entitete iz create_entity so placeholderji, veljajo samo za ukaze v istem bufferju
+        class CommandBuffer
         {
-            uint32_t comp_id1 = component_id<T1>();
+        public:
+            CommandBuffer() {}
+            CommandBuffer(const CommandBuffer&) = delete;
+            CommandBuffer& operator=(const CommandBuffer&) = delete;
+            ~CommandBuffer();
 
-            ASSERT(comp_id1 <= component_pools().size());
-            if (comp_id1 == component_pools().size())
+            Entity create_entity();
+            void destroy_entity(Entity entity);
+
+            template<typename T>
+            void add_component(T comp, Entity entity)
             {
-                auto pool = new ComponentPool<T1>();
-                component_pools().push_back((IComponentPool*)pool);
+                Command& command = push(CommandType::AddComponent, entity, &component_ops<T>);
+                new (command.data) T(std::move(comp));
             }
 
-            uint32_t comp_id2 = component_id<T2>();
-
-            ASSERT(comp_id2 <= component_pools().size());
-            if (comp_id2 == component_pools().size())
+            template<typename T>
+            void remove_component(Entity entity)
             {
-                auto pool = new ComponentPool<T2>();
-                component_pools().push_back((IComponentPool*)pool);
+                push(CommandType::RemoveComponent, entity, &component_ops<T>);
             }
 
-            auto p1 = (ComponentPool<T1>*)(component_pools()[comp_id1]);
-            auto p2 = (ComponentPool<T2>*)(component_pools()[comp_id2]);
-            return ComponentPoolCollectionIds2(p1, p2);
-        }
-
-        template<typename T1, typename T2, typename T3>
-        inline ComponentPoolCollectionIds3<T1, T2, T3> get_components_ids()
-        {
-            uint32_t comp_id1 = component_id<T1>();
-
-            ASSERT(comp_id1 <= component_pools().size());
-            if (comp_id1 == component_pools().size())
+            // prefab mora obstajati do execute()
+            // init(Entity, index) se klice ob execute za vsako novo entiteto, ko ze ima vse komponente prefaba,
+            // in pred njihovimi on_construct
+            // v init so dovoljene direktne spremembe (npr. ecs::add_component), ecs::commands() pa ne
+            template<typename Init>
+            void instantiate(const Prefab& prefab, size_t count, Init&& init)
             {
-                auto pool = new ComponentPool<T1>();
-                component_pools().push_back((IComponentPool*)pool);
+                Command& command = push(CommandType::Instantiate, NULL_ENTITY, &payload_ops<Instantiation>);
+                new (command.data) Instantiation{ &prefab, count, std::forward<Init>(init) };
             }
 
-            uint32_t comp_id2 = component_id<T2>();
-
-            ASSERT(comp_id2 <= component_pools().size());
-            if (comp_id2 == component_pools().size())
+            void instantiate(const Prefab& prefab, size_t count = 1)
             {
-                auto pool = new ComponentPool<T2>();
-                component_pools().push_back((IComponentPool*)pool);
+                instantiate(prefab, count, nullptr);
             }
 
-            uint32_t comp_id3 = component_id<T3>();
+            // izvede ukaze v vrstnem redu kot so bili zapisani in izprazni buffer
+            // ukazi za ze unicene entitete so ignorirani
+            // observerji in init med execute ne smejo zapisovati v ta buffer (assert)
+            void execute();
+
+            // premakne vse ukaze iz other na konec tega bufferja
+            void append(CommandBuffer& other);
 
-            ASSERT(comp_id3 <= component_pools().size());
-            if (comp_id3 == component_pools().size())
+            bool empty() const { return m_commands.empty(); }
+            size_t size() const { return m_commands.size(); }
+
+        private:
+            enum class CommandType : uint8_t
             {
-                auto pool = new ComponentPool<T3>();
-                component_pools().push_back((IComponentPool*)pool);
-            }
+                CreateEntity,
+                DestroyEntity,
+                AddComponent,
+                RemoveComponent,
+                Instantiate,
+            };
+
+            struct ComponentOps
+            {
+                size_t size;
+                size_t alignment;
+                void (*add)(void* comp, Entity entity);
+                void (*remove)(Entity entity);
+                void (*relocate)(void* dst, void* src);
+                void (*destroy)(void* comp);
+            };
+
+            template<typename T>
+            static inline const ComponentOps component_ops = {
+                sizeof(T),
+                alignof(T),
+                [](void* comp, Entity entity) { ecs::add_component(std::move(*(T*)comp), entity); },
+                [](Entity entity) { ecs::remove_component<T>(entity); },
+                [](void* dst, void* src) { new (dst) T(std::move(*(T*)src)); ((T*)src)->~T(); },
+                [](void* comp) { ((T*)comp)->~T(); },
+            };
+
+            // podatki ukazov, ki niso komponente
+            template<typename T>
+            static inline const ComponentOps payload_ops = {
+                sizeof(T),
+                alignof(T),
+                nullptr,
+                nullptr,
+                [](void* dst, void* src) { new (dst) T(std::move(*(T*)src)); ((T*)src)->~T(); },
+                [](void* data) { ((T*)data)->~T(); },
+            };
+
+            struct Instantiation
+            {
+                const Prefab* prefab;
+                size_t count;
+                std::function<void(Entity, size_t)> init;
+            };
 
-            auto p1 = (ComponentPool<T1>*)(component_pools()[comp_id1]);
-            auto p2 = (ComponentPool<T2>*)(component_pools()[comp_id2]);
-            auto p3 = (ComponentPool<T3>*)(component_pools()[comp_id3]);
-            return ComponentPoolCollectionIds3(p1, p2, p3);
-        }
+            struct Command
+            {
+                CommandType type;
+                Entity entity;
+                const ComponentOps* ops;
+                void* data; // komponenta za AddComponent, Instantiation za Instantiate
+            };
+
+            Command& push(CommandType type, Entity entity, const ComponentOps* ops);
+            void* allocate(size_t size, size_t alignment);
+            Entity resolve(Entity entity) const;
+            void clear();
+
+            std::vector<Command> m_commands;
+            uint32_t m_created_count = 0;
+            std::vector<Entity> m_created; // placeholder index -> prava entiteta, med execute
+            bool m_executing = false;
+
+            // komponente so v blokih fiksne velikosti, da se jim naslov ne spremeni
+            static constexpr size_t BLOCK_SIZE = 16 * 1024;
+            std::vector<uint8_t*> m_blocks;
+            size_t m_block = 0;
+            size_t m_block_offset = 0;
+        };
 
-        template<typename T>
-        inline void remove_all_with()
+        // buffer v katerega trenutno zapisuje ta thread
+        // izven sistemov in parallel_each je to glavni buffer, ki ga izvede execute_commands
+        CommandBuffer& commands();
+        // vrne prejsnji buffer, nullptr pomeni glavni buffer
+        CommandBuffer* set_commands(CommandBuffer* buffer);
+
+        // sync point: izvede glavni buffer
+        void execute_commands();
+
+        // neodvisna simulacija, npr. vec headless iger vzporedno na razlicnih threadih
+        // komponente imajo v vseh svetovih iste id, pooli in entitete pa so locene
+        class World
         {
-            std::vector<Entity> to_remove;
-            for (auto [id, comp] : ecs::get_components_ids<T>())
+        public:
+            World() {}
+            World(const World&) = delete;
+            World& operator=(const World&) = delete;
+            ~World();
+
+            std::vector<IComponentPool*> component_pools;
+            EntityTable entity_table;
+            std::vector<Group*> groups;
+
+            std::vector<std::unique_ptr<Query>> queries;
+            std::array<std::atomic<Query*>, MAX_QUERIES> query_slots = {};
+            std::vector<std::vector<Query*>> query_index;
+            std::mutex queries_mutex;
+
+            std::atomic_int structural_lock = 0;
+            uint32_t tick = 1;
+            uint32_t structural_changes = 0;
+            uint32_t prev_structural_changes = 0;
+
+            CommandBuffer commands;
+        };
+
+        // celotno stanje ECS (tabela entitet, vsi pooli) in stanje rand/randf main threada v enem binarnem blobu
+        // Model* in ostali kazalci v komponentah so veljavni samo znotraj istega zagona igre
+        std::vector<uint8_t> snapshot();
+        // pooli, ki jih v snapshotu ni, se izpraznijo, grupe se zgradijo na novo
+        void restore(const std::vector<uint8_t>& blob);
+
+        template<typename Func>
+        inline void parallel_for_chunks(size_t count, size_t min_chunk_size, Func&& func)
+        {
+            // vec chunkov kot threadov, da se delo bolje porazdeli
+            size_t chunks = (size_t)jobs::thread_count() * 4;
+            size_t chunk_size = std::max(min_chunk_size, (count + chunks - 1) / chunks);
+
+            structural_lock()++;
+            if (count <= chunk_size || jobs::thread_count() == 1)
             {
-                to_remove.push_back(id);
+                func((size_t)0, count);
             }
-
-            for (auto id : to_remove)
+            else
             {
-                ecs::destroy_entity(id);
+                // vsak chunk ima svoj buffer, na koncu se zdruzijo po vrsti chunkov
+                // da je rezultat neodvisen od tega kateri thread je izvedel kateri chunk
+                size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+                std::unique_ptr<CommandBuffer[]> chunk_commands = std::make_unique<CommandBuffer[]>(chunk_count);
+
+                jobs::WaitGroup wait_group;
+                for (size_t c = 0; c < chunk_count; c++)
+                {
+                    size_t begin = c * chunk_size;
+                    size_t end = std::min(begin + chunk_size, count);
+                    CommandBuffer* buffer = &chunk_commands[c];
+                    World* chunk_world = &world();
+                    jobs::submit([&func, begin, end, buffer, chunk_world]() {
+                        World* prev_world = set_world(chunk_world);
+                        CommandBuffer* prev = set_commands(buffer);
+                        func(begin, end);
+                        set_commands(prev);
+                        set_world(prev_world);
+                    }, wait_group);
+                }
+                jobs::wait(wait_group);
+
+                for (size_t c = 0; c < chunk_count; c++)
+                    commands().append(chunk_commands[c]);
             }
+            structural_lock()--;
         }
     }
-
-    // chatgpt mi je dal idejo kako bi z vecimi threadi hkrati updatal komponente
-    // in sicer bi grupiral sisteme glede na to katere komponente potrebujejo
-    // (to bi ugotovil z bit maskami) in potem vse neodvisne skupine izvedel na svojem threadu
-    // mimogrede koncno razumem kaj dela std::bind
 }
 
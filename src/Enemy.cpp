@@ -1,5 +1,6 @@
 ﻿#include "Enemy.h"
 #include "ECS.h"
+#include "Scheduler.h"
 #include "Player.h"
 #include "Components.h"
 #include "Renderer.h"
@@ -9,6 +10,7 @@
 #include "Settings.h"
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/norm.hpp>
+#include <algorithm>
 
 namespace kvejken
 {
@@ -23,8 +25,21 @@ namespace kvejken
         constexpr float MOVE_SPEED = 4.0f;
         constexpr float TURN_SPEED = 8.0f;
         constexpr float RAYCAST_DIST = 4.0f;
+        constexpr float SEPARATION_DIST = 6.0f;
+        // pool se uredi po istih celicah, v katerih separacija isce sosede
+        constexpr float SORT_CELL_SIZE = SEPARATION_DIST;
+        constexpr int SORT_INTERVAL_FRAMES = 30;
+        int m_frames_since_sort = 0;
         std::vector<glm::vec3> m_raycast_dirs;
 
+        struct EnemyCell
+        {
+            uint64_t cell; // morton_code s SEPARATION_DIST
+            glm::vec3 position;
+        };
+        // pozicije pred updatom, ker se med paralelnim updatom spreminjajo, urejene po celici
+        std::vector<EnemyCell> m_enemy_cells;
+
         constexpr glm::vec3 SPAWN_POINTS[] = {
             // zunaj
             glm::vec3(-34.6f, 2.5f, 1.3f),
@@ -74,6 +89,7 @@ namespace kvejken
 
             m_raycast_dirs.emplace_back(x, y, z);
         }
+        ASSERT(m_raycast_dirs.size() <= collision::RAYCAST_BATCH_MAX);
 
         // naredi samo colliderje
         for (auto spawn_point : SPAWN_POINTS)
@@ -93,9 +109,8 @@ namespace kvejken
         }
     }
 
-    void reset_enemies()
+    void reset_enemy_spawner()
     {
-        ecs::remove_all_with<Enemy>();
         m_spawner_active_time = 0.0f;
         m_time_to_spawn = time_btw_spawns(0.0f, 0);
     }
@@ -128,26 +143,50 @@ namespace kvejken
         if (ok_spawns.size() == 0)
             return SPAWN_POINTS[0];
 
-        int random = utils::rand(0, ok_spawns.size() - 1);
+        // update_enemies tece na workerju
+        utils::KeyedGenerator generator(NULL_ENTITY, ecs::tick());
+        int random = utils::rand(generator, 0, ok_spawns.size() - 1);
         return SPAWN_POINTS[ok_spawns[random]];
     }
 
+    // ustvari se ob prvem spawnu, ko so asseti ze nalozeni
+    static const ecs::Prefab& eel_prefab()
+    {
+        static ecs::Prefab prefab = [] {
+            Enemy enemy;
+            enemy.health = 100;
+            enemy.animation_time = 0.0f;
+
+            Transform transform;
+            transform.position = glm::vec3(0);
+            transform.rotation = glm::quat(1, 0, 0, 0);
+            transform.scale = 0.57f;
+
+            ecs::Prefab eel;
+            eel.set(enemy).set(transform).set<Model*>(&assets::eel_anim[0]);
+            return eel;
+        }();
+        return prefab;
+    }
+
     void spawn_enemy(glm::vec3 position, glm::vec3 rot_dir)
     {
-        Enemy enemy;
-        enemy.health = 100;
-        enemy.animation_time = 0.0f;
-
-        Transform transform;
-        transform.position = position;
-        transform.rotation = glm::quatLookAt(glm::normalize(-rot_dir), glm::vec3(0, 1, 0));
-        transform.scale = 0.57f;
-
-        Entity entity = ecs::create_entity();
-        ecs::add_component(enemy, entity);
-        ecs::add_component(transform, entity);
-        ecs::add_component(&assets::eel_anim[0], entity);
-        printf("spawn enemy id %u\n", entity);
+        spawn_enemies(position, rot_dir, 1);
+    }
+
+    void spawn_enemies(glm::vec3 position, glm::vec3 rot_dir, int count)
+    {
+        glm::quat rotation = glm::quatLookAt(glm::normalize(-rot_dir), glm::vec3(0, 1, 0));
+        // vec enemyjev se razporedi okoli pozicije, da se ne prekrivajo
+        float spread = count > 1 ? 0.5f * std::sqrt((float)count) : 0.0f;
+
+        ecs::commands().instantiate(eel_prefab(), count, [=](Entity entity, size_t i) {
+            Transform& transform = ecs::get_component<Transform>(entity);
+            transform.position = position;
+            if (i > 0)
+                transform.position += glm::vec3(utils::randf(-spread, spread), 0.0f, utils::randf(-spread, spread));
+            transform.rotation = rotation;
+        });
     }
 
     static void add_dir_to_steering_map(std::vector<float>& steering_map, glm::quat rotation, glm::vec3 direction, float strength)
@@ -161,11 +200,38 @@ namespace kvejken
         }
     }
 
+    static bool cell_less(const EnemyCell& a, const EnemyCell& b)
+    {
+        return a.cell < b.cell;
+    }
+
+    // poklice func za pozicije enemyjev v sosednjih celicah, ki so lahko blizje od SEPARATION_DIST
+    template <typename Func>
+    static void each_enemy_near(glm::vec3 position, Func func)
+    {
+        glm::vec3 cell = glm::floor(position / SEPARATION_DIST);
+        for (int z = -1; z <= 1; z++)
+        for (int y = -1; y <= 1; y++)
+        for (int x = -1; x <= 1; x++)
+        {
+            glm::vec3 center = (cell + glm::vec3(x, y, z) + 0.5f) * SEPARATION_DIST;
+            EnemyCell key = { utils::morton_code(center, SEPARATION_DIST), center };
+            auto [begin, end] = std::equal_range(m_enemy_cells.begin(), m_enemy_cells.end(), key, cell_less);
+            for (auto it = begin; it != end; ++it)
+                func(it->position);
+        }
+    }
+
+    ecs::SystemAccess update_enemies_access()
+    {
+        return ecs::SystemAccess()
+            .read<Player>()
+            .write<Enemy, Model*, Transform>();
+    }
+
     void update_enemies(float delta_time, float game_time)
     {
-        const auto pl = (*ecs::get_components<Player, Transform>().begin());
-        const Player& player = pl.first;
-        const Transform& player_transform = pl.second;
+        const auto [player, player_transform] = ecs::query<Player, Transform>().with<LocalPlayer>().single();
 
         // zacni s spawnanjem ko player pobere prvo orozje
         if (m_spawner_active_time == 0.0f && player.right_hand_item != WeaponType::None)
@@ -190,24 +256,39 @@ namespace kvejken
             }
         }
 
-        for (auto& [enemy, model, transform] : ecs::get_components<Enemy, Model*, Transform>())
-        {
-            enemy.animation_time += delta_time * utils::randf(0.9f, 1.1f);
+        glm::vec3 player_position = player_transform.position;
+
+        m_enemy_cells.clear();
+        ecs::group<Enemy, Model*, Transform>().each([](Enemy&, Model*&, Transform& transform) {
+            m_enemy_cells.push_back({ utils::morton_code(transform.position, SEPARATION_DIST), transform.position });
+        });
+        std::sort(m_enemy_cells.begin(), m_enemy_cells.end(), cell_less);
+
+        ecs::group_ids<Enemy, Model*, Transform>().parallel_each([&](Entity id, Enemy& enemy, Model*& model, Transform& transform) {
+            utils::KeyedGenerator generator(id, ecs::tick());
+            enemy.animation_time += delta_time * utils::randf(generator, 0.9f, 1.1f);
             if (enemy.animation_time >= ENEMY_ANIM_TIME)
                 enemy.animation_time -= ENEMY_ANIM_TIME;
 
             int anim = (int)(enemy.animation_time / ENEMY_ANIM_TIME * assets::eel_anim.size());
             model = &assets::eel_anim[anim];
 
-            //transform.rotation = glm::quatLookAt(glm::normalize(transform.position - player_transform.position), glm::vec3(0, 1, 0));
+            //transform.rotation = glm::quatLookAt(glm::normalize(transform.position - player_position), glm::vec3(0, 1, 0));
 
-            static std::vector<float> steering_map;
+            thread_local std::vector<float> steering_map;
             steering_map.clear();
             steering_map.resize(m_raycast_dirs.size(), 0.0f);
 
+            // vsi steering rayi gredo skozi BVH skupaj
+            glm::vec3 ray_dirs[collision::RAYCAST_BATCH_MAX];
+            std::optional<collision::RaycastHit> hits[collision::RAYCAST_BATCH_MAX];
+            for (int i = 0; i < m_raycast_dirs.size(); i++)
+                ray_dirs[i] = transform.rotation * m_raycast_dirs[i];
+            collision::raycast_batch(transform.position, ray_dirs, m_raycast_dirs.size(), RAYCAST_DIST, hits, false);
+
             for (int i = 0; i < m_raycast_dirs.size(); i++)
             {
-                auto hit = collision::raycast(transform.position, transform.rotation * m_raycast_dirs[i], RAYCAST_DIST, false);
+                const auto& hit = hits[i];
                 if (hit)
                 {
                     float danger01 = (1.0f - (hit->distance / RAYCAST_DIST));
@@ -218,22 +299,21 @@ namespace kvejken
             glm::vec3 forward = transform.rotation * glm::vec3(0, 0, 1);
             add_dir_to_steering_map(steering_map, transform.rotation, forward, 10.0f);
 
-            float player_dist = glm::distance(player_transform.position, transform.position);
+            float player_dist = glm::distance(player_position, transform.position);
             float player_follow_strength = 50.0f * (1.0f - glm::smoothstep(2.0f, 15.0f, player_dist)) + 50.0f;
-            add_dir_to_steering_map(steering_map, transform.rotation, player_transform.position - transform.position, player_follow_strength);
+            add_dir_to_steering_map(steering_map, transform.rotation, player_position - transform.position, player_follow_strength);
 
-            for (auto& [enemy2, transform2] : ecs::get_components<Enemy, Transform>())
-            {
-                if (transform.position != transform2.position)
+            each_enemy_near(transform.position, [&](const glm::vec3& position2) {
+                if (transform.position != position2)
                 {
-                    float dist2 = glm::distance2(transform.position, transform2.position);
-                    if (dist2 < 6.0f * 6.0f)
+                    float dist2 = glm::distance2(transform.position, position2);
+                    if (dist2 < SEPARATION_DIST * SEPARATION_DIST)
                     {
-                        float danger01 = (1.0f - (std::sqrt(dist2) / 6.0f));
-                        add_dir_to_steering_map(steering_map, transform.rotation, transform2.position - transform.position, -80 * danger01 * danger01);
+                        float danger01 = (1.0f - (std::sqrt(dist2) / SEPARATION_DIST));
+                        add_dir_to_steering_map(steering_map, transform.rotation, position2 - transform.position, -80 * danger01 * danger01);
                     }
                 }
-            }
+            });
 
             glm::vec3 best_direction(0);
             for (int i = 0; i < steering_map.size(); i++)
@@ -265,6 +345,7 @@ namespace kvejken
             if (settings::difficulty == 1) speed_mult *= 0.9f;
 
             transform.position += forward * MOVE_SPEED * speed_mult * delta_time;
+            ecs::mark_changed<Transform>(id);
 
             /*
             for (auto point : m_raycast_dirs)
@@ -273,7 +354,20 @@ namespace kvejken
                 renderer::draw_model(assets::test_cube.get(), point, glm::vec3(0), glm::vec3(0.05f));
             }
             */
-        }
+        });
+    }
+
+    void sort_enemies_spatially()
+    {
+        if (++m_frames_since_sort < SORT_INTERVAL_FRAMES)
+            return;
+        m_frames_since_sort = 0;
+
+        // Transform je v grupi z Enemy in Model*, zato se enako uredijo tudi enemyji,
+        // ostale entitete s Transform pa za njimi
+        ecs::sort_pool<Transform>([](Entity, const Transform& transform) {
+            return utils::morton_code(transform.position, SORT_CELL_SIZE);
+        });
     }
 
     void draw_enemy_spawns(float game_time)
@@ -2,6 +2,11 @@
 
 #include <glm/vec3.hpp>
 
+namespace kvejken::ecs
+{
+    struct SystemAccess;
+}
+
 namespace kvejken
 {
     struct Enemy
@@ -11,12 +16,18 @@ namespace kvejken
     };
 
     void init_enemies();
-    void reset_enemies();
+    void reset_enemy_spawner();
 
     float time_btw_spawns(float game_time, int player_progress);
     void spawn_enemy(glm::vec3 position, glm::vec3 rot_dir);
+    // vsi enemyji se ustvarijo naenkrat iz prefaba ob naslednjem ecs::execute_commands
+    void spawn_enemies(glm::vec3 position, glm::vec3 rot_dir, int count);
 
+    ecs::SystemAccess update_enemies_access();
     void update_enemies(float delta_time, float game_time);
+    // vsakih nekaj framov uredi enemyje in ostale Transform komponente po poziciji
+    // klice se na sync pointu, ko se sistemi ne izvajajo
+    void sort_enemies_spatially();
 
     void draw_enemy_spawns(float game_time);
 }
@@ -1,6 +1,8 @@
 ﻿#include "Interactable.h"
 #include "ECS.h"
+#include "Scheduler.h"
 #include "Components.h"
+#include "Transforms.h"
 #include "Model.h"
 #include "Assets.h"
 #include "Player.h"
@@ -110,6 +112,18 @@ namespace kvejken
         collider.width = 4.0f;
         collider.height = 5.8f;
 
+        Transform lever_transform;
+        lever_transform.position = lever_pos;
+        lever_transform.rotation = lever_rot * glm::angleAxis(PI / 2.0f, glm::vec3(0, 1, 0)) * rotation;
+        lever_transform.scale = 0.35f;
+
+        gate.lever = ecs::create_entity();
+        ecs::add_component(lever_transform, gate.lever);
+
+        gate.lever_hand = ecs::create_entity();
+        ecs::add_component(Transform{ glm::vec3(0.0f), glm::quat(1, 0, 0, 0), 1.0f }, gate.lever_hand);
+        ecs::add_component(Parent{ gate.lever }, gate.lever_hand);
+
         Entity e = ecs::create_entity();
         ecs::add_component(gate, e);
         ecs::add_component(inter, e);
@@ -118,54 +132,72 @@ namespace kvejken
         ecs::add_component(collider, e);
     }
 
-    static void spawn_weapon(WeaponType weapon_tag, glm::vec3 position, glm::quat rotation, int cost, bool add_collider = false)
+    // skupni del orozij in itemov, ki lezijo po tleh
+    // vrednosti, ki so odvisne od tipa, se nastavijo v init od instantiate
+    // Kind je WeaponType ali ItemType, v prefabu z vrednostjo None
+    template<typename Kind>
+    static ecs::Prefab pickup_prefab(Kind kind)
     {
-        const WeaponInfo& weapon = get_weapon_info(weapon_tag);
-
         Interactable inter = {};
         inter.max_player_dist = 1.5f;
-        inter.cost = cost;
 
         Transform transform;
-        transform.position = position + weapon.model_offset;
-        transform.rotation = rotation;
-        transform.scale = weapon.model_scale;
+        transform.position = glm::vec3(0);
+        transform.rotation = glm::quat(1, 0, 0, 0);
+        transform.scale = 1.0f;
 
-        Entity e = ecs::create_entity();
-        ecs::add_component(inter, e);
-        ecs::add_component(weapon.model, e);
-        ecs::add_component(transform, e);
-        ecs::add_component(weapon_tag, e);
-        if (add_collider)
-            ecs::add_component(collision::SphereCollider{ glm::vec3(0), 0.1f }, e);
+        ecs::Prefab prefab;
+        prefab.set(inter).set<Model*>(nullptr).set(transform).set(kind);
+        return prefab;
     }
 
-    static void spawn_item(ItemType item_tag, glm::vec3 position, glm::quat rotation, int cost, bool add_collider = false)
+    static void spawn_weapon(WeaponType weapon_tag, glm::vec3 position, glm::quat rotation, int cost, bool add_collider = false)
     {
-        const ItemInfo& item = get_item_info(item_tag);
-
-        Interactable inter = {};
-        inter.max_player_dist = 1.5f;
-        inter.cost = cost;
-
-        Transform transform;
-        transform.position = position;
-        transform.rotation = rotation;
-        transform.scale = item.model_scale;
+        static const ecs::Prefab prefab = pickup_prefab(WeaponType::None);
+
+        // klice se tudi iz update_interactables, zato gre preko command bufferja
+        ecs::commands().instantiate(prefab, 1, [=](Entity e, size_t) {
+            const WeaponInfo& weapon = get_weapon_info(weapon_tag);
+            ecs::get_component<Interactable>(e).cost = cost;
+            ecs::get_component<Model*>(e) = weapon.model;
+            ecs::get_component<WeaponType>(e) = weapon_tag;
+
+            Transform& transform = ecs::get_component<Transform>(e);
+            transform.position = position + weapon.model_offset;
+            transform.rotation = rotation;
+            transform.scale = weapon.model_scale;
+
+            if (add_collider)
+                ecs::add_component(collision::SphereCollider{ glm::vec3(0), 0.1f }, e);
+        });
+    }
 
-        Entity e = ecs::create_entity();
-        ecs::add_component(inter, e);
-        ecs::add_component(item.model, e);
-        ecs::add_component(transform, e);
-        ecs::add_component(item_tag, e);
-        if (add_collider)
-            ecs::add_component(collision::SphereCollider{ glm::vec3(0), 0.1f }, e);
+    static void spawn_item(ItemType item_tag, glm::vec3 position, glm::quat rotation, int cost, bool add_collider = false)
+    {
+        static const ecs::Prefab prefab = pickup_prefab(ItemType::None);
+
+        // klice se tudi iz update_interactables, zato gre preko command bufferja
+        ecs::commands().instantiate(prefab, 1, [=](Entity e, size_t) {
+            const ItemInfo& item = get_item_info(item_tag);
+            ecs::get_component<Interactable>(e).cost = cost;
+            ecs::get_component<Model*>(e) = item.model;
+            ecs::get_component<ItemType>(e) = item_tag;
+
+            Transform& transform = ecs::get_component<Transform>(e);
+            transform.position = position;
+            transform.rotation = rotation;
+            transform.scale = item.model_scale;
+
+            if (add_collider)
+                ecs::add_component(collision::SphereCollider{ glm::vec3(0), 0.1f }, e);
+        });
     }
 
-    static void spawn_fireplace(glm::vec3 position)
+    // ogenj nad kaminom in kipom
+    static ecs::Prefab fire_prefab(glm::vec3 color_a, glm::vec3 color_b, float max_player_dist, int cost)
     {
         Transform transform;
-        transform.position = position;
+        transform.position = glm::vec3(0);
         transform.rotation = glm::quat(1, 0, 0, 0);
         transform.scale = 1.0f;
 
@@ -181,53 +213,43 @@ namespace kvejken
         particles.min_velocity = 0.5f;
         particles.max_velocity = 0.75f;
         particles.velocity_offset = glm::vec3(0, 1, 0);
-        particles.color_a = glm::vec3(1, 0.01f, 0);
-        particles.color_b = glm::vec3(1, 0.03f, 0);
+        particles.color_a = color_a;
+        particles.color_b = color_b;
         particles.draw_layer = Layer::World;
 
         Interactable inter = {};
-        inter.max_player_dist = 2.0f;
-        inter.cost = (int)SpecialCost::Torch;
+        inter.max_player_dist = max_player_dist;
+        inter.cost = cost;
 
-        Entity entity = ecs::create_entity();
-        ecs::add_component(transform, entity);
-        ecs::add_component(particles, entity);
-        ecs::add_component(inter, entity);
-        ecs::add_component(Fireplace{}, entity);
+        ecs::Prefab prefab;
+        prefab.set(transform).set(particles).set(inter);
+        return prefab;
     }
 
-    static void spawn_healing_statue(glm::vec3 position)
+    static void spawn_fireplace(glm::vec3 position)
     {
-        Transform transform;
-        transform.position = position;
-        transform.rotation = glm::quat(1, 0, 0, 0);
-        transform.scale = 1.0f;
-
-        ParticleSpawner particles = {};
-        particles.active = true;
-        particles.spawn_rate = 120.0f;
-        particles.min_size = 0.04f;
-        particles.max_size = 0.08f;
-        particles.min_time_alive = 0.5f;
-        particles.max_time_alive = 0.8f;
-        particles.origin = glm::vec3(0, 0, 0);
-        particles.origin_radius = 0.2f;
-        particles.min_velocity = 0.5f;
-        particles.max_velocity = 0.75f;
-        particles.velocity_offset = glm::vec3(0, 1, 0);
-        particles.color_a = glm::vec3(0, 0.01f, 1);
-        particles.color_b = glm::vec3(0, 0.03f, 1);
-        particles.draw_layer = Layer::World;
-
-        Interactable inter = {};
-        inter.max_player_dist = 2.7f;
-        inter.cost = 100;
+        static const ecs::Prefab prefab = [] {
+            ecs::Prefab fireplace = fire_prefab(glm::vec3(1, 0.01f, 0), glm::vec3(1, 0.03f, 0), 2.0f, (int)SpecialCost::Torch);
+            fireplace.set(Fireplace{});
+            return fireplace;
+        }();
+
+        ecs::instantiate(prefab, 1, [=](Entity entity, size_t) {
+            ecs::get_component<Transform>(entity).position = position;
+        });
+    }
 
-        Entity entity = ecs::create_entity();
-        ecs::add_component(transform, entity);
-        ecs::add_component(particles, entity);
-        ecs::add_component(inter, entity);
-        ecs::add_component(HealingStatue{}, entity);
+    static void spawn_healing_statue(glm::vec3 position)
+    {
+        static const ecs::Prefab prefab = [] {
+            ecs::Prefab statue = fire_prefab(glm::vec3(0, 0.01f, 1), glm::vec3(0, 0.03f, 1), 2.7f, 100);
+            statue.set(HealingStatue{});
+            return statue;
+        }();
+
+        ecs::instantiate(prefab, 1, [=](Entity entity, size_t) {
+            ecs::get_component<Transform>(entity).position = position;
+        });
     }
 
     static void spawn_throne(glm::vec3 position)
@@ -278,15 +300,9 @@ namespace kvejken
 #endif
     }
 
-    void reset_interactables()
-    {
-        ecs::remove_all_with<Interactable>();
-        spawn_interactables();
-    }
-
     static void update_gates(Player& player, std::vector<Entity>& remove_interactable, float delta_time)
     {
-        for (auto [gate, transform] : ecs::get_components<Gate, Transform>())
+        for (auto [id, gate, transform] : ecs::get_components_ids<Gate, Transform>())
         {
             if (gate.anim_progress < 0.5f && gate.anim_progress + delta_time >= 0.5f)
                 player.screen_shake += 1.0f;
@@ -301,6 +317,7 @@ namespace kvejken
             if (gate.anim_progress > 0.5f && gate.anim_progress < GATE_OPEN_TIME)
             {
                 transform.position.y += GATE_OPEN_SPEED * delta_time;
+                ecs::mark_changed<Transform>(id);
             }
         }
 
@@ -363,7 +380,7 @@ namespace kvejken
 
                 player.right_hand_item = weapon;
                 player.right_hand_time_since_pickup = 0.0f;
-                ecs::queue_destroy_entity(id);
+                ecs::commands().destroy_entity(id);
             }
             else if (interactable.player_close)
             {
@@ -416,7 +433,7 @@ namespace kvejken
 
                 player.left_hand_item = item;
                 player.left_hand_time_since_pickup = 0.0f;
-                ecs::queue_destroy_entity(id);
+                ecs::commands().destroy_entity(id);
             }
             else if (interactable.player_close)
             {
@@ -450,7 +467,7 @@ namespace kvejken
 
     static void update_fireplace(Player& player)
     {
-        for (auto [fireplace, interactable] : ecs::get_components<Fireplace, Interactable>())
+        for (auto [interactable] : ecs::view<Interactable>().with<Fireplace>())
         {
             if (interactable.player_interacted)
             {
@@ -500,12 +517,12 @@ namespace kvejken
         }
 
         for (const auto& id : to_add_skull)
-            ecs::add_component(assets::skull.get(), id);
+            ecs::commands().add_component(assets::skull.get(), id);
     }
 
     static void update_healing_statue(Player& player)
     {
-        for (auto [healing_statue, interactable] : ecs::get_components<HealingStatue, Interactable>())
+        for (auto [interactable] : ecs::view<Interactable>().with<HealingStatue>())
         {
             if (interactable.player_interacted)
             {
@@ -532,12 +549,21 @@ namespace kvejken
         }
     }
 
+    ecs::SystemAccess update_interactables_access()
+    {
+        return ecs::SystemAccess()
+            .read<Fireplace, HealingStatue>()
+            .write<Player, Transform, Interactable, Gate, WeaponType, ItemType, Throne, Model*, collision::SphereCollider>()
+            .write<ecs::resource::DrawQueue>()
+            .on_main_thread();
+    }
+
     void update_interactables(float delta_time, float game_time)
     {
         static std::vector<Entity> remove_interactable;
         remove_interactable.clear();
 
-        auto [player, player_transform] = *ecs::get_components<Player, Transform>().begin();
+        auto [player, player_transform] = ecs::query<Player, Transform>().with<LocalPlayer>().single();
 
         update_gates(player, remove_interactable, delta_time);
         update_weapons(player, player_transform);
@@ -548,15 +574,15 @@ namespace kvejken
 
         for (const auto& entity : remove_interactable)
         {
-            ecs::remove_component<Interactable>(entity);
+            ecs::commands().remove_component<Interactable>(entity);
         }
     }
 
     void draw_levers()
     {
-        auto& player = *ecs::get_components<Player>().begin();
+        auto [player] = ecs::query<Player>().with<LocalPlayer>().single();
 
-        for (auto [id, gate, transform] : ecs::get_components_ids<Gate, Transform>())
+        for (auto [id, gate] : ecs::get_components_ids<Gate>())
         {
             if (!gate.opened)
             {
@@ -571,12 +597,10 @@ namespace kvejken
             if (frame >= assets::lever_anim.size())
                 frame = assets::lever_anim.size() - 1;
 
-            glm::quat rot = gate.lever_rot * glm::angleAxis(PI / 2.0f, glm::vec3(0, 1, 0)) * transform.rotation;
-
-            renderer::draw_model(&assets::lever_anim[frame], gate.lever_pos, rot, glm::vec3(0.35f));
+            renderer::draw_model(&assets::lever_anim[frame], world_matrix(gate.lever), normal_matrix(gate.lever));
 
             if (gate.opened && gate.anim_progress <= 0.5f)
-                renderer::draw_model(&assets::lever_hand_anim[frame], gate.lever_pos, rot, glm::vec3(0.35f));
+                renderer::draw_model(&assets::lever_hand_anim[frame], world_matrix(gate.lever_hand), normal_matrix(gate.lever_hand));
         }
     }
 }
@@ -1,6 +1,12 @@
 ﻿#pragma once
 #include <glm/vec3.hpp>
 #include "Model.h"
+#include "ECS.h"
+
+namespace kvejken::ecs
+{
+    struct SystemAccess;
+}
 
 namespace kvejken
 {
@@ -26,6 +32,10 @@ namespace kvejken
         float anim_progress;
         glm::vec3 lever_pos;
         glm::quat lever_rot;
+
+        // rocica se ne premika z vrati, roka je otrok rocice (Parent)
+        Entity lever;
+        Entity lever_hand;
     };
 
     enum class WeaponType : uint8_t
@@ -66,6 +76,7 @@ namespace kvejken
         glm::vec3 model_offset;
     };
 
+    // tagi, v querijih z with<Fireplace>()
     struct Fireplace {};
 
     struct HealingStatue {};
@@ -80,7 +91,7 @@ namespace kvejken
     const ItemInfo& get_item_info(ItemType type);
 
     void spawn_interactables();
-    void reset_interactables();
+    ecs::SystemAccess update_interactables_access();
     void update_interactables(float delta_time, float game_time);
 
     void draw_levers();
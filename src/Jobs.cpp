@@ -0,0 +1,134 @@
+﻿#include "Jobs.h"
+#include "Utils.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+
+namespace kvejken::jobs
+{
+    namespace
+    {
+        struct Job
+        {
+            std::function<void()> func;
+            WaitGroup* wait_group;
+        };
+
+        std::vector<std::thread> m_workers;
+        std::deque<Job> m_queue;
+        std::mutex m_queue_mutex;
+        std::condition_variable m_queue_cv;
+        bool m_stopping = false;
+
+        thread_local int m_thread_index = 0;
+    }
+
+    static bool pop_job(Job* job)
+    {
+        std::scoped_lock<std::mutex> lock(m_queue_mutex);
+        if (m_queue.empty())
+            return false;
+        *job = std::move(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+
+    static void run_job(Job& job)
+    {
+        job.func();
+        job.wait_group->done();
+    }
+
+    static void worker_loop(int index)
+    {
+        m_thread_index = index;
+
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_queue_cv.wait(lock, [] { return m_stopping || !m_queue.empty(); });
+                if (m_queue.empty())
+                    return;
+                job = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            run_job(job);
+        }
+    }
+
+    void init()
+    {
+        ASSERT(m_workers.empty());
+        m_stopping = false;
+
+        int workers = (int)std::thread::hardware_concurrency() - 1;
+        for (int i = 0; i < workers; i++)
+            m_workers.emplace_back(worker_loop, i + 1);
+
+        printf("job system: %d worker threads\n", workers);
+    }
+
+    void terminate()
+    {
+        {
+            std::scoped_lock<std::mutex> lock(m_queue_mutex);
+            m_stopping = true;
+        }
+        m_queue_cv.notify_all();
+
+        for (auto& worker : m_workers)
+            worker.join();
+        m_workers.clear();
+    }
+
+    int thread_count()
+    {
+        return (int)m_workers.size() + 1;
+    }
+
+    int thread_index()
+    {
+        return m_thread_index;
+    }
+
+    void submit(std::function<void()> job, WaitGroup& wait_group)
+    {
+        wait_group.add(1);
+
+        // brez workerjev se job izvede takoj
+        if (m_workers.empty())
+        {
+            job();
+            wait_group.done();
+            return;
+        }
+
+        {
+            std::scoped_lock<std::mutex> lock(m_queue_mutex);
+            m_queue.push_back(Job{ std::move(job), &wait_group });
+        }
+        m_queue_cv.notify_one();
+    }
+
+    bool run_one()
+    {
+        Job job;
+        if (!pop_job(&job))
+            return false;
+        run_job(job);
+        return true;
+    }
+
+    void wait(WaitGroup& wait_group)
+    {
+        while (!wait_group.finished())
+        {
+            if (!run_one())
+                std::this_thread::yield();
+        }
+    }
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+#include <functional>
+#include <atomic>
+
+namespace kvejken::jobs
+{
+    class WaitGroup
+    {
+    public:
+        void add(int count) { m_count += count; }
+        void done() { m_count--; }
+        bool finished() const { return m_count == 0; }
+
+    private:
+        std::atomic_int m_count = 0;
+    };
+
+    // zazene hardware_concurrency() - 1 worker threadov
+    void init();
+    void terminate();
+
+    // stevilo threadov ki izvajajo jobe (workerji + main thread)
+    int thread_count();
+    // 0 je main thread, workerji so 1..thread_count()-1
+    int thread_index();
+
+    void submit(std::function<void()> job, WaitGroup& wait_group);
+
+    // medtem ko caka tudi sam izvaja jobe, zato se lahko klice iz joba
+    void wait(WaitGroup& wait_group);
+    // izvede najvec en job iz vrste, vrne false ce je vrsta prazna
+    bool run_one();
+}
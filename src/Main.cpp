@@ -15,9 +15,47 @@
 #include "UI.h"
 #include "Particles.h"
 #include "Settings.h"
+#include "Jobs.h"
+#include "Scheduler.h"
+#include "Transforms.h"
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
 
 using namespace kvejken;
 
+static void draw_ecs_stats()
+{
+    const glm::vec4 color(0.9f, 0.9f, 0.1f, 0.9f);
+    ecs::Stats stats = ecs::stats();
+
+    char text[128];
+    float y = 400;
+
+    sprintf(text, "ECS %.1f KB", stats.total_bytes() / 1024.0f);
+    renderer::draw_text(text, glm::vec2(16, y), 32, color);
+    y += 32;
+
+    sprintf(text, "entitete %zu / %zu  tabela %.1f KB  signature %.1f KB (%u x 64 bit)",
+        stats.entities_alive, stats.entity_table_size, stats.entity_table_bytes / 1024.0f,
+        stats.signature_bytes / 1024.0f, stats.signature_words);
+    renderer::draw_text(text, glm::vec2(16, y), 24, color);
+    y += 24;
+
+    sprintf(text, "strukturne spremembe %u / frame", stats.structural_changes);
+    renderer::draw_text(text, glm::vec2(16, y), 24, color);
+    y += 32;
+
+    for (const auto& pool : stats.pools)
+    {
+        sprintf(text, "%.40s  %zu / %zu (max %zu)  %.1f KB  +%.1f KB prazno  +%.1f KB sparse",
+            pool.name, pool.live, pool.capacity, pool.peak, pool.bytes_used / 1024.0f,
+            pool.bytes_wasted / 1024.0f, pool.sparse_bytes / 1024.0f);
+        renderer::draw_text(text, glm::vec2(16, y), 24, color);
+        y += 24;
+    }
+}
+
 int main()
 {
     printf("pozdravljen svet\n");
@@ -47,20 +85,33 @@ int main()
 
     renderer::start_loading_defered_textures();
 
+    jobs::init();
+    atexit(jobs::terminate);
+
     init_enemies();
     init_weapon_item_infos();
 
     spawn_local_player(glm::vec3(0, 8, 0));
 
     spawn_interactables();
+    ecs::execute_commands();
+    ui::set_restart_snapshot(ecs::snapshot());
 
     collision::build_triangle_bvh(*assets::terrain, glm::vec3(0), glm::vec3(0), glm::vec3(1.0f));
+#ifdef KVEJKEN_BENCH_COLLISION
+    collision::benchmark_bvh();
+#endif
     for (auto& mesh : assets::terrain->meshes())
     {
         if (mesh.vertices().size() > 1000)
             mesh.prepare_vertex_buffer();
     }
 
+    ecs::add_system("update_players", update_players, update_players_access());
+    ecs::add_system("update_enemies", update_enemies, update_enemies_access());
+    ecs::add_system("update_interactables", update_interactables, update_interactables_access());
+    ecs::add_system("update_particles", update_particles, update_particles_access());
+
     float prev_time = glfwGetTime();
     float delta_time = 0.0f;
     float game_time = 0.0f;
@@ -89,26 +140,18 @@ int main()
         prev_time = real_time;
 
         collision::check_bvh_build_thread();
-        
 
+        // sistemi uporabljajo matrike in collider cache iz konca prejsnjega frama, na zacetku je igra pavzirana
         if (!paused)
-        {
-            update_players(delta_time, game_time);
-
-            update_enemies(delta_time, game_time);
+            ecs::run_systems(delta_time, game_time);
 
-            update_interactables(delta_time, game_time);
-
-            update_particles(delta_time, game_time);
-        }
 
+        ecs::execute_commands();
+        sort_enemies_spatially();
+        ecs::advance_tick();
 
-        ecs::destroy_queued_entities();
-        /*
-        printf("ecs components:\n");
-        for (const auto& pool : ecs::component_pools())
-            printf("component pool %s size %d\n", pool->component_name(), (int)pool->size());
-        */
+        update_world_transforms();
+        collision::update_collider_cache();
 
         renderer::clear_screen();
 
@@ -137,11 +180,8 @@ int main()
         */
 
         /*
-        for (auto [player, transform] : ecs::get_components<Player, Transform>())
+        for (auto [player, transform] : ecs::get_components<Player, Transform>().with<LocalPlayer>())
         {
-            if (!player.local)
-                continue;
-
             for (int i = 0; i < 300; i++)
             {
                 glm::vec3 dir = glm::normalize(glm::vec3(utils::randf(-0.2f, 0.2f), utils::randf(-0.2f, 0.2f), -1.0f));
@@ -154,14 +194,15 @@ int main()
         }
         */
 
-        for (auto [model, transform] : ecs::get_components<Model*, Transform>())
+        for (auto [id, model, transform] : ecs::get_components_ids<Model*, Transform>())
         {
-            renderer::draw_model(model, transform.position, transform.rotation, glm::vec3(transform.scale));
+            renderer::draw_model(model, world_matrix(id), normal_matrix(id));
         }
 
         draw_enemy_spawns(game_time);
         draw_particles(game_time);
         draw_levers();
+        draw_first_person_models();
 
         if (settings::get().draw_fps)
         {
@@ -183,8 +224,19 @@ int main()
             char text[64];
             sprintf(text, "%d fps (%.1f ms)", (int)std::round(1.0f / displayed_frametime), displayed_frametime * 1000.0f);
             renderer::draw_text(text, glm::vec2(16, 144), 48, glm::vec4(0.1f, 0.9f, 0.1f, 0.9f));
+
+            float y = 184;
+            for (const auto& timing : ecs::system_timings())
+            {
+                sprintf(text, "%s  %.2f ms (thread %d)", timing.name, timing.duration_ms, timing.thread_index);
+                renderer::draw_text(text, glm::vec2(16, y), 32, glm::vec4(0.1f, 0.9f, 0.1f, 0.9f));
+                y += 32;
+            }
         }
 
+        if (settings::get().draw_ecs_stats)
+            draw_ecs_stats();
+
         ui::draw_and_update_ui();
 
         if (ui::current_menu() == ui::Menu::Main)
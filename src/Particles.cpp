@@ -1,20 +1,18 @@
 ﻿#include "Particles.h"
 #include "ECS.h"
+#include "Scheduler.h"
 #include "Renderer.h"
 #include "Model.h"
 #include "Assets.h"
 #include "Components.h"
-#include <glm/gtc/random.hpp>
+#include "Transforms.h"
 #include <memory>
 
 namespace kvejken
 {
     void spawn_particle_explosion(const ParticleExplosionParameters& params)
     {
-        Entity e = ecs::create_entity();
-        ecs::add_component(ParticleExplosion{}, e);
-
-        ParticleExplosion& pe = ecs::get_component<ParticleExplosion>(e);
+        ParticleExplosion pe;
         pe.time = 0.0f;
         pe.max_time = params.max_time_alive;
         pe.draw_layer = params.draw_layer;
@@ -27,31 +25,40 @@ namespace kvejken
             pe.particles[i].size = utils::randf(params.min_size, params.max_size);
             pe.particles[i].time_alive = utils::randf(params.min_time_alive, params.max_time_alive);
             pe.particles[i].position = params.origin;
-            pe.particles[i].velocity = glm::sphericalRand(utils::randf(params.min_velocity, params.max_velocity)) + params.velocity_offset;
+            pe.particles[i].velocity = utils::sphere_rand(utils::randf(params.min_velocity, params.max_velocity)) + params.velocity_offset;
             pe.particles[i].color = glm::mix(params.color_a, params.color_b, utils::randf(0.0f, 1.0f));
         }
+
+        // ustvarjena je ob naslednjem ecs::execute_commands
+        Entity e = ecs::commands().create_entity();
+        ecs::commands().add_component(std::move(pe), e);
+    }
+
+    ecs::SystemAccess update_particles_access()
+    {
+        // pozicija spawnerja je iz world matrike s sync pointa, zato ne bere Transform in se lahko izvaja hkrati z enemyji
+        return ecs::SystemAccess()
+            .write<ParticleExplosion, ParticleSpawner>();
     }
 
     void update_particles(float delta_time, float game_time)
     {
-        for (auto [id, particle_explosion] : ecs::get_components_ids<ParticleExplosion>())
-        {
+        ecs::parallel_each_ids<ParticleExplosion>([&](Entity id, ParticleExplosion& particle_explosion) {
             particle_explosion.time += delta_time;
 
             if (particle_explosion.time > particle_explosion.max_time)
             {
-                ecs::queue_destroy_entity(id);
-                continue;
+                ecs::commands().destroy_entity(id);
+                return;
             }
 
             for (auto& particle : particle_explosion.particles)
             {
                 particle.position += particle.velocity * delta_time;
             }
-        }
+        });
 
-        for (auto& [spawner, transform] : ecs::get_components<ParticleSpawner, Transform>())
-        {
+        ecs::parallel_each_ids<ParticleSpawner>([&](Entity id, ParticleSpawner& spawner) {
             if (spawner.active)
                 spawner.time += delta_time;
 
@@ -59,13 +66,16 @@ namespace kvejken
             {
                 spawner.time = 0.0f;
 
+                // neodvisno od workerja, na katerem se spawner izvede
+                utils::KeyedGenerator generator(id, ecs::tick());
+
                 Particle p;
-                p.size = utils::randf(spawner.min_size, spawner.max_size);
-                p.time_alive = game_time + utils::randf(spawner.min_time_alive, spawner.max_time_alive);
-                p.position = spawner.origin + transform.position;
-                if (spawner.origin_radius > 0.0f) p.position += glm::ballRand(spawner.origin_radius);
-                p.velocity = glm::sphericalRand(utils::randf(spawner.min_velocity, spawner.max_velocity)) + spawner.velocity_offset;
-                p.color = glm::mix(spawner.color_a, spawner.color_b, utils::randf(0.0f, 1.0f));
+                p.size = utils::randf(generator, spawner.min_size, spawner.max_size);
+                p.time_alive = game_time + utils::randf(generator, spawner.min_time_alive, spawner.max_time_alive);
+                p.position = spawner.origin + glm::vec3(world_matrix(id)[3]);
+                if (spawner.origin_radius > 0.0f) p.position += utils::ball_rand(generator, spawner.origin_radius);
+                p.velocity = utils::sphere_rand(generator, utils::randf(generator, spawner.min_velocity, spawner.max_velocity)) + spawner.velocity_offset;
+                p.color = glm::mix(spawner.color_a, spawner.color_b, utils::randf(generator, 0.0f, 1.0f));
 
                 if (spawner.next_index < spawner.particles.size())
                 {
@@ -88,7 +98,7 @@ namespace kvejken
             {
                 particle.position += particle.velocity * delta_time;
             }
-        }
+        });
     }
 
     void draw_particles(float game_time)
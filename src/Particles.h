@@ -4,6 +4,12 @@
 #include <glm/vec4.hpp>
 #include <vector>
 #include "Renderer.h"
+#include "ECS.h"
+
+namespace kvejken::ecs
+{
+    struct SystemAccess;
+}
 
 namespace kvejken
 {
@@ -55,7 +61,90 @@ namespace kvejken
     };
 
     void spawn_particle_explosion(const ParticleExplosionParameters& params);
+}
+
+namespace kvejken::ecs
+{
+    // delci so v std::vector, zato jih ne moremo kopirati z memcpy
+    template<>
+    struct ComponentSerializer<ParticleExplosion>
+    {
+        static void save(std::vector<uint8_t>& blob, const ComponentStorage<ParticleExplosion>& comps)
+        {
+            write_value(blob, (uint64_t)comps.size());
+            for (size_t i = 0; i < comps.size(); i++)
+            {
+                const ParticleExplosion& pe = comps[i];
+                write_vector(blob, pe.particles);
+                write_value(blob, pe.time);
+                write_value(blob, pe.max_time);
+                write_value(blob, pe.draw_layer);
+            }
+        }
+
+        static void load(const uint8_t*& data, ComponentStorage<ParticleExplosion>& comps)
+        {
+            uint64_t count;
+            read_value(data, count);
+            comps.resize(count);
+            for (size_t i = 0; i < comps.size(); i++)
+            {
+                ParticleExplosion& pe = comps[i];
+                read_vector(data, pe.particles);
+                read_value(data, pe.time);
+                read_value(data, pe.max_time);
+                read_value(data, pe.draw_layer);
+            }
+        }
+    };
+
+    template<>
+    struct ComponentSerializer<ParticleSpawner>
+    {
+        // isti seznam polj za save in load
+        template<typename S, typename Func>
+        static void fields(S& s, Func&& func)
+        {
+            func(s.active); func(s.spawn_rate); func(s.time); func(s.next_index);
+            func(s.min_size); func(s.max_size);
+            func(s.min_time_alive); func(s.max_time_alive);
+            func(s.origin); func(s.origin_radius);
+            func(s.min_velocity); func(s.max_velocity);
+            func(s.velocity_offset);
+            func(s.color_a); func(s.color_b);
+            func(s.draw_layer);
+        }
+
+        static void save(std::vector<uint8_t>& blob, const ComponentStorage<ParticleSpawner>& comps)
+        {
+            write_value(blob, (uint64_t)comps.size());
+            for (size_t i = 0; i < comps.size(); i++)
+            {
+                const ParticleSpawner& spawner = comps[i];
+                write_vector(blob, spawner.particles);
+                fields(spawner, [&](const auto& value) { write_value(blob, value); });
+            }
+        }
+
+        static void load(const uint8_t*& data, ComponentStorage<ParticleSpawner>& comps)
+        {
+            uint64_t count;
+            read_value(data, count);
+            comps.resize(count);
+            for (size_t i = 0; i < comps.size(); i++)
+            {
+                ParticleSpawner& spawner = comps[i];
+                read_vector(data, spawner.particles);
+                fields(spawner, [&](auto& value) { read_value(data, value); });
+            }
+        }
+    };
+}
+
+namespace kvejken
+{
 
+    ecs::SystemAccess update_particles_access();
     void update_particles(float delta_time, float game_time);
 
     void draw_particles(float game_time);
@@ -1,6 +1,8 @@
 ﻿#include "Player.h"
 #include "ECS.h"
+#include "Scheduler.h"
 #include "Components.h"
+#include "Transforms.h"
 #include "Input.h"
 #include "Collision.h"
 #include "Assets.h"
@@ -59,11 +61,22 @@ namespace kvejken
         return nullptr;
     }
 
+    static Entity spawn_first_person_hand(Entity* out_model)
+    {
+        Entity hand = ecs::create_entity();
+        ecs::add_component(Transform{ glm::vec3(0.0f), glm::quat(1, 0, 0, 0), 1.0f }, hand);
+
+        *out_model = ecs::create_entity();
+        ecs::add_component(Transform{ glm::vec3(0.0f), glm::quat(1, 0, 0, 0), 1.0f }, *out_model);
+        ecs::add_component(Parent{ hand }, *out_model);
+        ecs::add_component(FirstPersonModel{ nullptr }, *out_model);
+        return hand;
+    }
+
     void spawn_local_player(glm::vec3 position)
     {
         Player player = {};
         player.health = 100;
-        player.local = true;
         player.points = 0;
         player.right_hand_item = WeaponType::None;
         player.left_hand_item = ItemType::None;
@@ -71,6 +84,8 @@ namespace kvejken
         player.time_since_recv_damage = 99.0f;
         player.progress = 0;
         player.curr_objective = Objective::PickUpWeapon;
+        player.left_hand = spawn_first_person_hand(&player.left_hand_model);
+        player.right_hand = spawn_first_person_hand(&player.right_hand_model);
 
 #ifdef KVEJKEN_TEST
         player.points = 2069;
@@ -114,21 +129,18 @@ namespace kvejken
         ecs::add_component(transform, entity);
         ecs::add_component(light, entity);
         ecs::add_component(particles, entity);
-    }
-
-    void reset_player()
-    {
-        ecs::remove_all_with<Player>();
-        spawn_local_player(glm::vec3(0, 8, 0));
+        ecs::add_component(LocalPlayer{}, entity);
     }
 
     void update_players_movement(float delta_time, float game_time)
     {
-        for (auto [player, transform] : ecs::get_components<Player, Transform>())
+        for (auto [id, player, transform] : ecs::get_components_ids<Player, Transform>().with<LocalPlayer>())
         {
-            if (!player.local || player.health <= 0)
+            if (player.health <= 0)
                 continue;
 
+            ecs::mark_changed<Transform>(id);
+
             glm::vec3 forward = transform.rotation * glm::vec3(0, 0, -1);
             glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0, 1, 0)));
             glm::vec3 move_dir = {};
@@ -207,7 +219,7 @@ namespace kvejken
 
     static void attack(Player& player, glm::vec3 blade_pos, float attack_radius, glm::vec3 camera_pos)
     {
-        Entity closest = -1;
+        Entity closest = NULL_ENTITY;
         float closest_dist = (attack_radius + 1.25f) * (attack_radius + 1.25f);
         glm::vec3 enemy_pos;
 
@@ -223,7 +235,7 @@ namespace kvejken
         }
 
         // hit
-        if (closest != (Entity)-1)
+        if (closest != NULL_ENTITY)
         {
             ParticleExplosionParameters particle_params;
             particle_params.min_count = 10;
@@ -241,7 +253,7 @@ namespace kvejken
             particle_params.draw_layer = Layer::World;
             spawn_particle_explosion(particle_params);
 
-            ecs::queue_destroy_entity(closest);
+            ecs::commands().destroy_entity(closest);
 
             if (settings::fast_demo)
             {
@@ -340,7 +352,7 @@ namespace kvejken
         glm::vec3 pickup_offset = glm::vec3(0, glm::smoothstep(0.0f, 0.2f, player.right_hand_time_since_pickup) - 1.0f, 0);
 
         glm::vec3 weapon_offset = glm::vec3(0.3f * left_mult, -0.5f, -0.5f);
-        glm::mat4 weapon_rotation(1.0f);
+        glm::quat weapon_rotation(1, 0, 0, 0);
         glm::vec3 weapon_pivot = glm::vec3(0, -1.375f, 0);
         if (player.time_since_attack < weapon.attack_time)
         {
@@ -351,7 +363,7 @@ namespace kvejken
             glm::quat rot1 = glm::angleAxis(glm::radians(-50.0f * left_mult), glm::vec3(0, 0, 1));
             glm::quat rot2 = glm::angleAxis(glm::radians(150.0f * left_mult), glm::vec3(0, 1, 0))
                 * glm::angleAxis(glm::radians(-50.0f * left_mult), glm::vec3(0, 0, 1));
-            weapon_rotation = glm::toMat4(glm::slerp(rot1, rot2, t));
+            weapon_rotation = glm::slerp(rot1, rot2, t);
         }
         else if (player.time_since_attack < weapon.attack_time + weapon_return_time)
         {
@@ -364,17 +376,21 @@ namespace kvejken
             glm::quat rot1 = glm::angleAxis(glm::radians(150.0f * left_mult), glm::vec3(0, 1, 0))
                 * glm::angleAxis(glm::radians(-50.0f * left_mult), glm::vec3(0, 0, 1));
             glm::quat rot2 = player.attack_from_left ? glm::quat(0, 0, 1, 0) : glm::quat(1, 0, 0, 0);
-            weapon_rotation = glm::toMat4(glm::slerp(rot1, rot2, t));
+            weapon_rotation = glm::slerp(rot1, rot2, t);
         }
 
-        glm::mat4 t = glm::translate(glm::mat4(1.0f), hand_position)
-            * glm::toMat4(player.right_hand_rotation)
-            * glm::translate(glm::mat4(1.0f), weapon_offset + weapon_pivot + pickup_offset)
-            * weapon_rotation
-            * glm::translate(glm::mat4(1.0f), weapon.model_offset - weapon_pivot)
-            * glm::scale(glm::mat4(1.0f), glm::vec3(weapon.model_scale / 0.5f * 0.3f));
+        ecs::get_component<Transform>(player.right_hand) = Transform{ hand_position, player.right_hand_rotation, 1.0f };
+        ecs::mark_changed<Transform>(player.right_hand);
 
-        renderer::draw_model(weapon.model, t, Layer::FirstPerson);
+        // orozje je otrok roke, rotacija okoli pivota je vsebovana v poziciji
+        Transform& weapon_transform = ecs::get_component<Transform>(player.right_hand_model);
+        weapon_transform.position = weapon_offset + weapon_pivot + pickup_offset + weapon_rotation * (weapon.model_offset - weapon_pivot);
+        weapon_transform.rotation = weapon_rotation;
+        weapon_transform.scale = weapon.model_scale / 0.5f * 0.3f;
+        ecs::mark_changed<Transform>(player.right_hand_model);
+        ecs::get_component<FirstPersonModel>(player.right_hand_model).model = weapon.model;
+
+        glm::mat4 t = current_world_matrix(player.right_hand_model);
 
         if (player.time_since_attack > weapon.attack_time * 0.21f && player.time_since_attack < weapon.attack_time * 0.45f
             && !player.attack_hit && !player.attack_miss)
@@ -386,6 +402,15 @@ namespace kvejken
         }
     }
 
+    ecs::SystemAccess update_players_access()
+    {
+        return ecs::SystemAccess()
+            .read<Model*, LocalPlayer, Parent>()
+            .write<Player, Camera, Transform, PointLight, ParticleSpawner, Enemy, Interactable, FirstPersonModel>()
+            .write<ecs::resource::DrawQueue>()
+            .on_main_thread();
+    }
+
     void update_players(float delta_time, float game_time)
     {
         int substeps = (int)(delta_time / 0.007) + 1;
@@ -393,9 +418,9 @@ namespace kvejken
         for (int i = 0; i < substeps; i++)
             update_players_movement(sub_delta, game_time);
 
-        for (auto [player, player_transform] : ecs::get_components<Player, Transform>())
+        for (auto [player, player_transform] : ecs::get_components<Player, Transform>().with<LocalPlayer>())
         {
-            if (!player.local || player.health <= 0)
+            if (player.health <= 0)
                 continue;
 
             for (auto [enemy_id, enemy, enemy_transform] : ecs::get_components_ids<Enemy, Transform>())
@@ -404,14 +429,18 @@ namespace kvejken
                 {
                     damage_player(player, utils::rand(15, 30), enemy_transform.position);
                     if (player.health > 0)
-                        ecs::queue_destroy_entity(enemy_id);
+                        ecs::commands().destroy_entity(enemy_id);
                 }
             }
         }
 
-        for (auto [id, player, camera, transform] : ecs::get_components_ids<Player, Camera, Transform>())
+        for (auto [id, player, camera, transform] : ecs::get_components_ids<Player, Camera, Transform>().with<LocalPlayer>())
         {
-            if (!player.local || player.health <= 0)
+            // predmeta se izriseta samo, ce ju ta frame nastavi orozje ali item
+            ecs::get_component<FirstPersonModel>(player.left_hand_model).model = nullptr;
+            ecs::get_component<FirstPersonModel>(player.right_hand_model).model = nullptr;
+
+            if (player.health <= 0)
                 continue;
 
             if (input::is_mouse_locked() && player.forced_movement_time <= 0.0f)
@@ -421,6 +450,7 @@ namespace kvejken
                 player.look_pitch -= mouse_delta.y * settings::get().mouse_speed / 1.0f / 10000.0f;
                 player.look_pitch = glm::clamp(player.look_pitch, -PI / 2.0f + 0.01f, PI / 2.0f - 0.01f);
                 transform.rotation = glm::quat(glm::vec3(player.look_pitch, player.look_yaw, 0.0f));
+                ecs::mark_changed<Transform>(id);
             }
             else if (player.forced_movement_time > 0.0f)
             {
@@ -429,6 +459,7 @@ namespace kvejken
                 player.look_yaw = std::atan2(-rot_forward.z, rot_forward.x) - PI / 2.0f;
                 player.look_pitch = std::asin(rot_forward.y);
                 transform.rotation = glm::quat(glm::vec3(player.look_pitch, player.look_yaw, 0.0f));
+                ecs::mark_changed<Transform>(id);
             }
 
             if (input::key_pressed(settings::get().key_jump) && game_time <= player.jump_allowed_time)
@@ -484,12 +515,14 @@ namespace kvejken
 
                 glm::vec3 pickup_offset = glm::vec3(0, glm::smoothstep(0.0f, 0.2f, player.left_hand_time_since_pickup) - 1.0f, 0);
 
-                glm::mat4 t = glm::translate(glm::mat4(1.0f), hand_position)
-                    * glm::toMat4(player.left_hand_rotation)
-                    * glm::translate(glm::mat4(1.0f), item.model_offset + pickup_offset)
-                    * glm::scale(glm::mat4(1.0f), glm::vec3(item.model_scale));
+                ecs::get_component<Transform>(player.left_hand) = Transform{ hand_position, player.left_hand_rotation, 1.0f };
+                ecs::mark_changed<Transform>(player.left_hand);
 
-                renderer::draw_model(item.model, t, Layer::FirstPerson);
+                ecs::get_component<Transform>(player.left_hand_model) = Transform{ item.model_offset + pickup_offset, glm::quat(1, 0, 0, 0), item.model_scale };
+                ecs::mark_changed<Transform>(player.left_hand_model);
+                ecs::get_component<FirstPersonModel>(player.left_hand_model).model = item.model;
+
+                glm::mat4 t = current_world_matrix(player.left_hand_model);
 
                 PointLight& point_light = ecs::get_component<PointLight>(id);
                 if (player.left_hand_item == ItemType::LitTorch)
@@ -506,7 +539,7 @@ namespace kvejken
 
             Interactable* closest_interactable = nullptr;
             float closest_dist = 1e30f;
-            for (auto [interactable, interactable_transform] : ecs::get_components<Interactable, Transform>())
+            for (auto [interactable, interactable_transform] : ecs::query<Interactable, Transform>())
             {
                 glm::vec3 dir = interactable_transform.position - transform.position;
                 float dist = glm::length2(dir);
@@ -562,9 +595,9 @@ namespace kvejken
                 renderer::draw_rect(glm::vec2(1920 / 2, 1080 / 2), glm::vec2(1920, 1080) * 10.0f, glm::vec4(1.0f, 0.0f, 0.0f, 0.08f * (std::sin(7*game_time)+1)/2));
         }
 
-        for (auto [player, light, transform] : ecs::get_components<Player, PointLight, Transform>())
+        for (auto [player, light, transform] : ecs::get_components<Player, PointLight, Transform>().with<LocalPlayer>())
         {
-            if (!player.local || player.health <= 0)
+            if (player.health <= 0)
                 continue;
 
             float sun = glm::smoothstep(1.5f, 2.7f, transform.position.y);
@@ -585,9 +618,9 @@ namespace kvejken
             }
         }
 
-        for (auto& [player, particle_spawner] : ecs::get_components<Player, ParticleSpawner>())
+        for (auto& [player, particle_spawner] : ecs::get_components<Player, ParticleSpawner>().with<LocalPlayer>())
         {
-            if (player.local && player.health <= 0)
+            if (player.health <= 0)
             {
                 renderer::draw_rect(glm::vec2(1920 / 2, 1080 / 2), glm::vec2(1920, 1080) * 10.0f, glm::vec4(1.0f, 0.0f, 0.0f, 0.3f));
 
@@ -598,6 +631,15 @@ namespace kvejken
         }
     }
 
+    void draw_first_person_models()
+    {
+        for (auto [id, first_person] : ecs::get_components_ids<FirstPersonModel>())
+        {
+            if (first_person.model)
+                renderer::draw_model(first_person.model, world_matrix(id), normal_matrix(id), Layer::FirstPerson);
+        }
+    }
+
     void damage_player(Player& player, int damage, glm::vec3 attack_pos)
     {
         player.health -= damage;
@@ -631,12 +673,12 @@ namespace kvejken
 
     void add_screen_shake(float amount)
     {
-        ecs::get_components<Player>().begin()->screen_shake += amount;
+        std::get<0>(ecs::query<Player>().with<LocalPlayer>().single()).screen_shake += amount;
     }
 
     void objective_complete(Objective completed_objective)
     {
-        auto& player = *ecs::get_components<Player>().begin();
+        auto [player] = ecs::query<Player>().with<LocalPlayer>().single();
 
         if (player.curr_objective <= completed_objective)
             player.curr_objective = (Objective)((int)completed_objective + 1);
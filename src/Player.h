@@ -5,6 +5,11 @@
 #include <glm/gtc/quaternion.hpp>
 #include "Interactable.h"
 
+namespace kvejken::ecs
+{
+    struct SystemAccess;
+}
+
 namespace kvejken
 {
     enum Objective
@@ -20,10 +25,18 @@ namespace kvejken
         Done,
     };
 
+    // tag za igralca, ki ga upravlja ta racunalnik
+    struct LocalPlayer {};
+
+    // predmet v roki igralca, entiteta je otrok roke (Parent), izrise se v Layer::FirstPerson
+    struct FirstPersonModel
+    {
+        const Model* model; // nullptr, ko je roka prazna
+    };
+
     struct Player
     {
         int health;
-        bool local;
 
         glm::vec2 move_velocity;
         float velocity_y;
@@ -41,6 +54,9 @@ namespace kvejken
         ItemType left_hand_item;
         WeaponType right_hand_item;
         glm::quat left_hand_rotation, right_hand_rotation;
+        // roki sta entiteti s Transform v svetu, predmeta v njih sta njuna otroka s FirstPersonModel
+        Entity left_hand, right_hand;
+        Entity left_hand_model, right_hand_model;
         float left_hand_time_since_pickup;
         float right_hand_time_since_pickup;
 
@@ -59,9 +75,11 @@ namespace kvejken
     };
 
     void spawn_local_player(glm::vec3 position);
-    void reset_player();
 
+    ecs::SystemAccess update_players_access();
     void update_players(float delta_time, float game_time);
+    // klice se po update_world_transforms
+    void draw_first_person_models();
 
     void damage_player(Player& player, int damage, glm::vec3 attack_pos);
 
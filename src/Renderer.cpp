@@ -21,6 +21,7 @@
 #include <mutex>
 #include "ECS.h"
 #include "Components.h"
+#include "Transforms.h"
 #include "Shader.h"
 #include "Input.h"
 
@@ -48,6 +49,7 @@ namespace kvejken::renderer
             DrawOrderKey order;
             const Mesh* mesh;
             glm::mat4 transform;
+            glm::mat4 normal_transform;
             uint32_t color;
         };
         std::vector<DrawCommand> m_draw_queue;
@@ -380,7 +382,7 @@ namespace kvejken::renderer
     {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        auto [camera, transform] = *(ecs::get_components<Camera, Transform>().begin());
+        auto [camera, transform] = ecs::query<Camera, Transform>().single();
         m_camera = camera;
         m_camera.position += transform.position;
         m_camera.direction = transform.rotation * m_camera.direction;
@@ -443,13 +445,13 @@ namespace kvejken::renderer
         m_batched_textures.clear();
     }
 
-    static void draw_single_mesh(const Mesh* mesh, const glm::mat4& transform)
+    static void draw_single_mesh(const Mesh* mesh, const glm::mat4& transform, const glm::mat4& normal_transform)
     {
         glBindVertexArray(mesh->vertex_array_id());
 
         m_shader.set_uniform("u_model_view_proj", m_view_proj * transform);
         m_shader.set_uniform("u_model", transform);
-        m_shader.set_uniform("u_normal_mat", glm::transpose(glm::inverse(transform)));
+        m_shader.set_uniform("u_normal_mat", normal_transform);
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, mesh->diffuse_texture().id);
@@ -507,7 +509,7 @@ namespace kvejken::renderer
 
             if (mesh->has_vertex_buffer())
             {
-                draw_single_mesh(mesh, m_draw_queue[i].transform);
+                draw_single_mesh(mesh, m_draw_queue[i].transform, m_draw_queue[i].normal_transform);
                 continue;
             }
 
@@ -531,7 +533,7 @@ namespace kvejken::renderer
                 m_batched_textures.push_back(mesh->diffuse_texture().id);
             }
 
-            glm::mat4 normal_matrix = glm::transpose(glm::inverse(m_draw_queue[i].transform));
+            const glm::mat4& normal_matrix = m_draw_queue[i].normal_transform;
 
             for (const auto& vertex : mesh->vertices())
             {
@@ -808,34 +810,33 @@ namespace kvejken::renderer
 
     void draw_model(const Model* model, glm::vec3 position, glm::quat rotation, glm::vec3 scale, Layer layer, glm::vec4 color)
     {
-        glm::mat4 transform = glm::translate(glm::mat4(1.0f), position)
-            * glm::toMat4(rotation)
-            * glm::scale(glm::mat4(1.0f), scale);
-
-        for (int i = 0; i < model->meshes().size(); i++)
-        {
-            draw_mesh(&(model->meshes()[i]), transform, layer, color);
-        }
+        draw_model(model, local_matrix(position, rotation, scale), layer, color);
     }
 
     void draw_mesh(const Mesh* mesh, glm::vec3 position, glm::quat rotation, glm::vec3 scale, Layer layer, glm::vec4 color)
     {
-        glm::mat4 transform = glm::translate(glm::mat4(1.0f), position)
-            * glm::toMat4(rotation)
-            * glm::scale(glm::mat4(1.0f), scale);
-
-        draw_mesh(mesh, transform, layer, color);
+        draw_mesh(mesh, local_matrix(position, rotation, scale), layer, color);
     }
 
     void draw_model(const Model* model, const glm::mat4& transform, Layer layer, glm::vec4 color)
+    {
+        draw_model(model, transform, glm::transpose(glm::inverse(transform)), layer, color);
+    }
+
+    void draw_mesh(const Mesh* mesh, const glm::mat4& transform, Layer layer, glm::vec4 color)
+    {
+        draw_mesh(mesh, transform, glm::transpose(glm::inverse(transform)), layer, color);
+    }
+
+    void draw_model(const Model* model, const glm::mat4& transform, const glm::mat4& normal_transform, Layer layer, glm::vec4 color)
     {
         for (int i = 0; i < model->meshes().size(); i++)
         {
-            draw_mesh(&(model->meshes()[i]), transform, layer, color);
+            draw_mesh(&(model->meshes()[i]), transform, normal_transform, layer, color);
         }
     }
 
-    void draw_mesh(const Mesh* mesh, const glm::mat4& transform, Layer layer, glm::vec4 color)
+    void draw_mesh(const Mesh* mesh, const glm::mat4& transform, const glm::mat4& normal_transform, Layer layer, glm::vec4 color)
     {
         if (mesh->diffuse_texture() == Texture{ 0 })
         {
@@ -869,7 +870,7 @@ namespace kvejken::renderer
         constexpr int max_depth = (1 << 21) - 1; // for 21 bits
         order.depth = (int)(distance01 * max_depth);
 
-        m_draw_queue.push_back({ order, mesh, transform, utils::vec_to_rgba8(color) });
+        m_draw_queue.push_back({ order, mesh, transform, normal_transform, utils::vec_to_rgba8(color) });
     }
     
     constexpr uint32_t decode_2_byte_utf8(char byte1, char byte2)
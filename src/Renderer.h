@@ -91,6 +91,10 @@ namespace kvejken::renderer
     void draw_model(const Model* model, const glm::mat4& transform, Layer layer = Layer::World, glm::vec4 color = glm::vec4(1.0f));
     void draw_mesh(const Mesh* mesh, const glm::mat4& transform, Layer layer = Layer::World, glm::vec4 color = glm::vec4(1.0f));
 
+    // normal_transform = transpose(inverse(transform)), npr. iz normal_matrix(), da se ne racuna za vsak mesh
+    void draw_model(const Model* model, const glm::mat4& transform, const glm::mat4& normal_transform, Layer layer = Layer::World, glm::vec4 color = glm::vec4(1.0f));
+    void draw_mesh(const Mesh* mesh, const glm::mat4& transform, const glm::mat4& normal_transform, Layer layer = Layer::World, glm::vec4 color = glm::vec4(1.0f));
+
     void load_font(const char* font_file);
     void draw_text(const char* text, glm::vec2 position, int size, glm::vec4 color = glm::vec4(1.0f), Align horizontal_align = Align::Left);
     bool draw_button(const char* text, glm::vec2 position, int size, glm::vec2 rect_size, glm::vec4 color = glm::vec4(1.0f), Align horizontal_align = Align::Left, uint64_t repeats_id = 0);
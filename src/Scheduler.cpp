@@ -0,0 +1,175 @@
+﻿#include "Scheduler.h"
+#include "Jobs.h"
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <thread>
+
+namespace kvejken::ecs
+{
+    namespace
+    {
+        struct System
+        {
+            const char* name;
+            SystemFunc func;
+            SystemAccess access;
+            std::unique_ptr<CommandBuffer> commands;
+        };
+
+        struct FrameState
+        {
+            float delta_time;
+            float game_time;
+            World* world;
+            std::chrono::steady_clock::time_point start_time;
+
+            std::vector<std::vector<int>> dependents;
+            std::unique_ptr<std::atomic_int[]> remaining_deps;
+
+            std::mutex main_thread_mutex;
+            std::vector<int> main_thread_ready;
+
+            jobs::WaitGroup wait_group;
+        };
+
+        std::vector<System> m_systems;
+        std::vector<SystemTiming> m_timings;
+    }
+
+    static bool intersects(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+    {
+        for (uint32_t id : a)
+        {
+            if (std::find(b.begin(), b.end(), id) != b.end())
+                return true;
+        }
+        return false;
+    }
+
+    bool SystemAccess::conflicts_with(const SystemAccess& other) const
+    {
+        return intersects(writes, other.writes) || intersects(writes, other.reads) || intersects(reads, other.writes);
+    }
+
+    void add_system(const char* name, SystemFunc func, SystemAccess access)
+    {
+        m_systems.push_back(System{ name, func, std::move(access), std::make_unique<CommandBuffer>() });
+    }
+
+    static void schedule_system(FrameState& frame, int index);
+
+    static void execute_system(FrameState& frame, int index)
+    {
+        const System& system = m_systems[index];
+
+        auto start = std::chrono::steady_clock::now();
+        World* prev_world = set_world(frame.world);
+        CommandBuffer* prev_commands = set_commands(system.commands.get());
+        system.func(frame.delta_time, frame.game_time);
+        set_commands(prev_commands);
+        set_world(prev_world);
+        auto end = std::chrono::steady_clock::now();
+
+        std::chrono::duration<float, std::milli> start_ms = start - frame.start_time;
+        std::chrono::duration<float, std::milli> duration_ms = end - start;
+        m_timings[index] = SystemTiming{ system.name, start_ms.count(), duration_ms.count(), jobs::thread_index() };
+
+        // odvisne sisteme je treba zagnati preden se ta oznaci kot koncan
+        for (int dependent : frame.dependents[index])
+        {
+            if (--frame.remaining_deps[dependent] == 0)
+                schedule_system(frame, dependent);
+        }
+    }
+
+    static void schedule_system(FrameState& frame, int index)
+    {
+        if (m_systems[index].access.main_thread)
+        {
+            std::scoped_lock<std::mutex> lock(frame.main_thread_mutex);
+            frame.wait_group.add(1);
+            frame.main_thread_ready.push_back(index);
+        }
+        else
+        {
+            jobs::submit([&frame, index]() { execute_system(frame, index); }, frame.wait_group);
+        }
+    }
+
+    void run_systems(float delta_time, float game_time)
+    {
+        ASSERT(jobs::thread_index() == 0);
+
+        int count = (int)m_systems.size();
+
+        FrameState frame;
+        frame.delta_time = delta_time;
+        frame.game_time = game_time;
+        frame.world = &world();
+        frame.start_time = std::chrono::steady_clock::now();
+        frame.dependents.resize(count);
+        frame.remaining_deps = std::make_unique<std::atomic_int[]>(count);
+
+        // sistem je odvisen od vseh prej dodanih sistemov s katerimi je v konfliktu
+        for (int i = 0; i < count; i++)
+        {
+            frame.remaining_deps[i] = 0;
+            for (int j = 0; j < i; j++)
+            {
+                if (m_systems[i].access.conflicts_with(m_systems[j].access))
+                {
+                    frame.dependents[j].push_back(i);
+                    frame.remaining_deps[i]++;
+                }
+            }
+        }
+
+        m_timings.resize(count);
+
+        // korenski sistemi morajo biti znani preden se kateri zazene,
+        // sicer bi lahko ze koncan sistem odvisnega zagnal se enkrat
+        std::vector<int> roots;
+        for (int i = 0; i < count; i++)
+        {
+            if (frame.remaining_deps[i] == 0)
+                roots.push_back(i);
+        }
+        for (int root : roots)
+            schedule_system(frame, root);
+
+        while (!frame.wait_group.finished())
+        {
+            int index = -1;
+            {
+                std::scoped_lock<std::mutex> lock(frame.main_thread_mutex);
+                if (!frame.main_thread_ready.empty())
+                {
+                    index = frame.main_thread_ready.front();
+                    frame.main_thread_ready.erase(frame.main_thread_ready.begin());
+                }
+            }
+
+            if (index != -1)
+            {
+                execute_system(frame, index);
+                frame.wait_group.done();
+            }
+            else if (!jobs::run_one())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        // spremembe sistemov gredo v glavni buffer v vrstnem redu dodajanja sistemov,
+        // izvedejo se ob execute_commands
+        for (System& system : m_systems)
+            commands().append(*system.commands);
+    }
+
+    const std::vector<SystemTiming>& system_timings()
+    {
+        return m_timings;
+    }
+}
@@ -0,0 +1,59 @@
+﻿#pragma once
+#include "ECS.h"
+#include <vector>
+
+namespace kvejken::ecs
+{
+    // deljeni resourci ki niso komponente, sistemi jih deklarirajo enako kot komponente
+    namespace resource
+    {
+        struct EntityTable; // direktni create/destroy entitet in add/remove komponent, mimo ecs::commands()
+        struct DrawQueue; // renderer::draw_*
+    }
+
+    struct SystemAccess
+    {
+        std::vector<uint32_t> reads;
+        std::vector<uint32_t> writes;
+        bool main_thread = false; // npr. za input ki klice glfw
+
+        template<typename... Ts>
+        SystemAccess& read()
+        {
+            (reads.push_back(component_id<Ts>()), ...);
+            return *this;
+        }
+
+        template<typename... Ts>
+        SystemAccess& write()
+        {
+            (writes.push_back(component_id<Ts>()), ...);
+            return *this;
+        }
+
+        SystemAccess& on_main_thread()
+        {
+            main_thread = true;
+            return *this;
+        }
+
+        bool conflicts_with(const SystemAccess& other) const;
+    };
+
+    using SystemFunc = void(*)(float delta_time, float game_time);
+
+    struct SystemTiming
+    {
+        const char* name;
+        float start_ms; // od zacetka run_systems
+        float duration_ms;
+        int thread_index;
+    };
+
+    // sistemi v konfliktu se izvedejo v vrstnem redu dodajanja
+    // vsak sistem ima svoj ecs::commands() buffer in dela s trenutnim svetom main threada
+    void add_system(const char* name, SystemFunc func, SystemAccess access);
+    void run_systems(float delta_time, float game_time);
+
+    const std::vector<SystemTiming>& system_timings();
+}
@@ -39,6 +39,8 @@ namespace kvejken::settings
 
             m_data.window_pos = glm::vec2(100, 100);
             m_data.window_size = glm::vec2(1280, 720);
+
+            m_data.draw_ecs_stats = false;
         }
     }
 
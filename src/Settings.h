@@ -22,6 +22,9 @@ namespace kvejken::settings
 
         glm::vec2 window_pos;
         glm::vec2 window_size;
+
+        // nova polja na konec, da stare shranjene nastavitve se delujejo
+        bool draw_ecs_stats;
     };
 
     SettingsData& get();
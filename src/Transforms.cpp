@@ -0,0 +1,183 @@
+﻿#include "Transforms.h"
+#include <vector>
+#include <algorithm>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+namespace kvejken
+{
+    namespace
+    {
+        struct WorldMatrices
+        {
+            glm::mat4 world;
+            glm::mat4 normal;
+        };
+
+        // po entity_index
+        std::vector<WorldMatrices> m_matrices;
+        // prehod, v katerem je bila matrika nazadnje preracunana, da otroci vedo ali se je stars spremenil
+        std::vector<uint32_t> m_updated_pass;
+        // tick zadnjega preracuna, za cache izven tega modula
+        std::vector<uint32_t> m_updated_tick;
+        uint32_t m_pass = 0;
+        uint32_t m_tick = 0;
+
+        struct Child
+        {
+            Entity entity;
+            bool had_parent; // ob prejsnjem prehodu, ce stars umre se mora otrok preracunati
+        };
+
+        // entitete s Parent in Transform, urejene po globini v hierarhiji
+        std::vector<Child> m_children;
+        bool m_hierarchy_changed = true;
+        bool m_observers_connected = false;
+
+        constexpr uint32_t MAX_DEPTH = 64;
+    }
+
+    glm::mat4 local_matrix(glm::vec3 position, glm::quat rotation, glm::vec3 scale)
+    {
+        return glm::translate(glm::mat4(1.0f), position)
+            * glm::toMat4(rotation)
+            * glm::scale(glm::mat4(1.0f), scale);
+    }
+
+    static void set_world_matrix(Entity entity, const glm::mat4& world)
+    {
+        uint32_t index = ecs::entity_index(entity);
+        if (index >= m_matrices.size())
+        {
+            m_matrices.resize(index + 1);
+            m_updated_pass.resize(index + 1, 0);
+            m_updated_tick.resize(index + 1, 0);
+        }
+
+        m_matrices[index].world = world;
+        m_matrices[index].normal = glm::transpose(glm::inverse(world));
+        m_updated_pass[index] = m_pass;
+        m_updated_tick[index] = m_tick;
+    }
+
+    static uint32_t hierarchy_depth(Entity entity)
+    {
+        ComponentPool<Parent>& parents = ecs::get_components<Parent>();
+
+        uint32_t depth = 0;
+        while (const Parent* parent = parents.try_get_component(entity))
+        {
+            entity = parent->entity;
+            depth++;
+            ASSERT(depth < MAX_DEPTH); // cikel v hierarhiji
+        }
+        return depth;
+    }
+
+    static void rebuild_hierarchy()
+    {
+        std::vector<std::pair<uint32_t, Entity>> by_depth;
+        for (auto [id, parent, transform] : ecs::get_components_ids<Parent, Transform>())
+            by_depth.push_back({ hierarchy_depth(id), id });
+        std::sort(by_depth.begin(), by_depth.end());
+
+        m_children.clear();
+        for (const auto& [depth, id] : by_depth)
+            m_children.push_back(Child{ id, true });
+    }
+
+    void update_world_transforms()
+    {
+        if (!m_observers_connected)
+        {
+            auto hierarchy_changed = [](Entity, Parent&) { m_hierarchy_changed = true; };
+            ecs::on_construct<Parent>().connect(hierarchy_changed);
+            ecs::on_destroy<Parent>().connect(hierarchy_changed);
+            ecs::on_update<Parent>().connect(hierarchy_changed);
+            m_observers_connected = true;
+        }
+
+        uint32_t since = m_tick;
+        m_tick = ecs::tick();
+        m_pass++;
+
+        // restore ne sprozi observerjev, komponente pa dobijo novo verzijo
+        ecs::get_components<Parent>().each_changed_since(since, [](Entity, Parent&) { m_hierarchy_changed = true; });
+
+        // sprememba hierarhije je redka, takrat se preracuna vse
+        if (m_hierarchy_changed)
+        {
+            rebuild_hierarchy();
+            m_hierarchy_changed = false;
+            since = 0;
+        }
+
+        ComponentPool<Transform>& transforms = ecs::get_components<Transform>();
+        transforms.each_changed_since(since, [](Entity id, Transform& transform) {
+            if (!ecs::has_component<Parent>(id))
+                set_world_matrix(id, local_matrix(transform));
+        });
+
+        // starsi so v m_children pred otroki, zato je njihova matrika ze posodobljena
+        for (Child& child : m_children)
+        {
+            Entity parent = ecs::get_component<Parent>(child.entity).entity;
+            bool has_parent = ecs::is_alive(parent) && transforms.has_component(parent);
+            bool parent_lost = child.had_parent && !has_parent;
+            child.had_parent = has_parent;
+
+            uint32_t parent_index = ecs::entity_index(parent);
+            bool parent_updated = has_parent && parent_index < m_updated_pass.size() && m_updated_pass[parent_index] == m_pass;
+            if (!parent_updated && !parent_lost && !transforms.changed_since(child.entity, since))
+                continue;
+
+            glm::mat4 local = local_matrix(transforms.get_component(child.entity));
+            if (has_parent)
+                set_world_matrix(child.entity, m_matrices[parent_index].world * local);
+            else
+                set_world_matrix(child.entity, local);
+        }
+    }
+
+    const glm::mat4& world_matrix(Entity entity)
+    {
+        uint32_t index = ecs::entity_index(entity);
+        ASSERT(index < m_matrices.size()); // update_world_transforms ni bil poklican
+        return m_matrices[index].world;
+    }
+
+    const glm::mat4& normal_matrix(Entity entity)
+    {
+        uint32_t index = ecs::entity_index(entity);
+        ASSERT(index < m_matrices.size());
+        return m_matrices[index].normal;
+    }
+
+    bool world_matrix_changed_since(Entity entity, uint32_t tick)
+    {
+        uint32_t index = ecs::entity_index(entity);
+        ASSERT(index < m_updated_tick.size());
+        return m_updated_tick[index] >= tick;
+    }
+
+    glm::mat4 current_world_matrix(Entity entity)
+    {
+        ComponentPool<Parent>& parents = ecs::get_components<Parent>();
+        ComponentPool<Transform>& transforms = ecs::get_components<Transform>();
+
+        glm::mat4 world = local_matrix(transforms.get_component(entity));
+        uint32_t depth = 0;
+        while (const Parent* parent = parents.try_get_component(entity))
+        {
+            entity = parent->entity;
+            if (!ecs::is_alive(entity) || !transforms.has_component(entity))
+                break;
+
+            world = local_matrix(transforms.get_component(entity)) * world;
+            depth++;
+            ASSERT(depth < MAX_DEPTH); // cikel v hierarhiji
+        }
+        return world;
+    }
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "ECS.h"
+#include "Components.h"
+
+namespace kvejken
+{
+    // Transform otroka je relativen na starsa, ob menjavi starsa je treba klicati mark_changed<Parent>
+    struct Parent
+    {
+        Entity entity;
+    };
+
+    glm::mat4 local_matrix(glm::vec3 position, glm::quat rotation, glm::vec3 scale);
+
+    inline glm::mat4 local_matrix(const Transform& transform)
+    {
+        return local_matrix(transform.position, transform.rotation, glm::vec3(transform.scale));
+    }
+
+    // world in normal matrike vseh entitet s Transform v enem prehodu: najprej korenske entitete, nato otroci po globini
+    // preracunajo se samo entitete s spremenjenim Transform (mark_changed) in njihovi potomci
+    // klice se na sync pointu, ko se sistemi ne izvajajo
+    void update_world_transforms();
+
+    const glm::mat4& world_matrix(Entity entity);
+    // transpose(inverse(world)) za normale
+    const glm::mat4& normal_matrix(Entity entity);
+    // tudi ce se je spremenil le kateri od starsev, since kot pri each_changed_since
+    bool world_matrix_changed_since(Entity entity, uint32_t tick);
+
+    // world matrika iz trenutnih Transform entitete in njenih starsev, brez cacha
+    // za sisteme, ki jo rabijo isti frame, preden se poklice update_world_transforms
+    glm::mat4 current_world_matrix(Entity entity);
+}
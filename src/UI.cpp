@@ -4,6 +4,7 @@
 #include "Settings.h"
 #include "Enemy.h"
 #include "Player.h"
+#include "ECS.h"
 #include <glm/vec2.hpp>
 #include <cstdlib>
 #include <algorithm>
@@ -17,6 +18,8 @@ namespace kvejken::ui
         std::vector<Menu> m_menu_history;
 
         int* m_changing_keybind = nullptr;
+
+        std::vector<uint8_t> m_restart_snapshot;
     }
 
     static void set_menu(Menu menu)
@@ -187,6 +190,7 @@ namespace kvejken::ui
         y += 80;
 
         draw_on_off_input(u8"Prikaži FPS", &settings::get().draw_fps, y); y += 80;
+        draw_on_off_input(u8"Prikaži ECS statistiko", &settings::get().draw_ecs_stats, y); y += 80;
 
         if (renderer::draw_button("Urejanje tipk", glm::vec2(1920 / 2, y), 64, glm::vec2(400, 64), glm::vec4(1.0f), Align::Center))
             set_menu(Menu::Keybinds);
@@ -245,9 +249,9 @@ namespace kvejken::ui
             m_curr_menu = Menu::Main;
             m_menu_history.clear();
 
-            reset_enemies();
-            reset_player();
-            reset_interactables();
+            // namesto unicevanja in ponovnega spawnanja entitet
+            ecs::restore(m_restart_snapshot);
+            reset_enemy_spawner();
 
             renderer::set_sun_light(1.0f);
         }
@@ -274,6 +278,11 @@ namespace kvejken::ui
         }
     }
 
+    void set_restart_snapshot(std::vector<uint8_t> snapshot)
+    {
+        m_restart_snapshot = std::move(snapshot);
+    }
+
     Menu current_menu()
     {
         return m_curr_menu;
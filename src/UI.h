@@ -1,4 +1,6 @@
 ﻿#pragma once
+#include <vector>
+#include <cstdint>
 
 namespace kvejken::ui
 {
@@ -15,5 +17,8 @@ namespace kvejken::ui
     void draw_and_update_ui();
 
     Menu current_menu();
+
+    // stanje sveta na zacetku igre, "Zapusti igro" ga nalozi nazaj
+    void set_restart_snapshot(std::vector<uint8_t> snapshot);
 }
 
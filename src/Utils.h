@@ -12,6 +12,8 @@
 #include <glm/common.hpp>
 #include <chrono>
 #include <mutex>
+#include <atomic>
+#include <cmath>
 
 #ifdef WIN32
 #define DEBUG_BREAK() __debugbreak()
@@ -90,6 +92,24 @@ namespace kvejken::utils
         return vi;
     }
 
+    // z-order krivulja, bliznje tocke imajo blizje kode
+    // 21 bitov na os, okoli izhodisca je prostora za 2^20 celic v vsako smer
+    inline uint64_t morton_code(glm::vec3 position, float cell_size)
+    {
+        auto spread = [](uint64_t x) {
+            x = (x | x << 32) & 0x001F00000000FFFF;
+            x = (x | x << 16) & 0x001F0000FF0000FF;
+            x = (x | x << 8) & 0x100F00F00F00F00F;
+            x = (x | x << 4) & 0x10C30C30C30C30C3;
+            x = (x | x << 2) & 0x1249249249249249;
+            return x;
+        };
+
+        constexpr float max_cell = (float)((1 << 21) - 1);
+        glm::vec3 cell = glm::clamp(glm::floor(position / cell_size) + (float)(1 << 20), 0.0f, max_cell);
+        return spread((uint64_t)cell.x) | spread((uint64_t)cell.y) << 1 | spread((uint64_t)cell.z) << 2;
+    }
+
     // normalized for range [-1, 2]
     inline glm::u16vec2 pack_texture_coords(glm::vec2 v)
     {
@@ -141,21 +161,107 @@ namespace kvejken::utils
             point.y <= rect_pos.y + rect_size.y / 2.0f;
     }
 
+    // vsak generator dobi svoj seed, sicer bi workerji dobili enaka zaporedja
+    inline uint32_t next_generator_seed()
+    {
+        static std::atomic_uint32_t counter = 0;
+        return std::mt19937::default_seed + counter++;
+    }
+
+    // generator je na vsakem threadu svoj, ker se sistemi izvajajo na vec threadih
+    // stanje generatorjev main threada je del ecs::snapshot()
+    inline std::mt19937& int_generator()
+    {
+        thread_local std::mt19937 generator(next_generator_seed());
+        return generator;
+    }
+
+    inline std::mt19937& float_generator()
+    {
+        thread_local std::mt19937 generator(next_generator_seed());
+        return generator;
+    }
+
+    // generator za sisteme na workerjih in telesa parallel_each, npr. s kljucem entitete in ecs::tick()
+    // rezultat ni odvisen od threada in vrstnega reda izvajanja, zato ga snapshot ne rabi shraniti
+    struct KeyedGenerator
+    {
+        using result_type = uint64_t;
+        uint64_t state;
+
+        KeyedGenerator(uint32_t key, uint32_t tick)
+            : state((uint64_t)key << 32 | tick) {}
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return UINT64_MAX; }
+
+        // splitmix64
+        result_type operator()()
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+            return z ^ (z >> 31);
+        }
+    };
+
     // both min and max inclusive
-    inline int rand(int min, int max)
+    template<typename Generator>
+    inline int rand(Generator& generator, int min, int max)
     {
-        static std::mt19937 generator;
         std::uniform_int_distribution<int> distribution(min, max);
         return distribution(generator);
     }
 
-    inline float randf(float min, float max)
+    template<typename Generator>
+    inline float randf(Generator& generator, float min, float max)
     {
-        static std::mt19937 generator;
         std::uniform_real_distribution<float> distribution(min, max);
         return distribution(generator);
     }
 
+    // namesto glm::sphericalRand in glm::ballRand, ki uporabljata std::rand in nista varna za vec threadov
+    template<typename Generator>
+    inline glm::vec3 sphere_rand(Generator& generator, float radius)
+    {
+        float z = randf(generator, -1.0f, 1.0f);
+        float angle = randf(generator, 0.0f, 2.0f * PI);
+        float r = std::sqrt(1.0f - z * z);
+        return glm::vec3(r * std::cos(angle), r * std::sin(angle), z) * radius;
+    }
+
+    template<typename Generator>
+    inline glm::vec3 ball_rand(Generator& generator, float radius)
+    {
+        glm::vec3 p;
+        do
+        {
+            p = glm::vec3(randf(generator, -radius, radius), randf(generator, -radius, radius), randf(generator, -radius, radius));
+        } while (p.x * p.x + p.y * p.y + p.z * p.z > radius * radius);
+        return p;
+    }
+
+    // na main threadu, na workerjih KeyedGenerator
+    inline int rand(int min, int max)
+    {
+        return rand(int_generator(), min, max);
+    }
+
+    inline float randf(float min, float max)
+    {
+        return randf(float_generator(), min, max);
+    }
+
+    inline glm::vec3 sphere_rand(float radius)
+    {
+        return sphere_rand(float_generator(), radius);
+    }
+
+    inline glm::vec3 ball_rand(float radius)
+    {
+        return ball_rand(float_generator(), radius);
+    }
+
     inline int round_to_multiple(int n, int multiple)
     {
         int r = n + multiple / 2;